@@ -0,0 +1,481 @@
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <ao/ao.h>
+#include <mpg123.h>
+
+#include "Audio.h"
+#include "Trace.h"
+
+#define BITS 8
+
+using namespace std;
+
+/* Single producer / single consumer byte ring - the decoder thread writes, the
+   device thread reads. head and tail only ever grow and are wrapped with mask,
+   so neither side ever takes a lock. */
+struct AudioRing {
+    vector<unsigned char> data;
+    size_t mask;
+    alignas(64) atomic<size_t> head;   // bytes written so far, owned by the producer
+    alignas(64) atomic<size_t> tail;   // bytes read so far, owned by the consumer
+
+    AudioRing (size_t capacity) : data(capacity), mask(capacity - 1), head(0), tail(0) {}
+
+    // Producer side: copy up to n bytes in, returns how many fit
+    size_t write (const unsigned char* src, size_t n)
+    {
+        size_t h = head.load(memory_order_relaxed);
+        size_t t = tail.load(memory_order_acquire);
+        size_t space = data.size() - (h - t);
+        if(n > space)
+          n = space;
+        for(size_t k = 0; k < n; )
+        {
+          size_t at = (h + k) & mask;
+          size_t run = min(n - k, data.size() - at);
+          memcpy(&data[at], src + k, run);
+          k += run;
+        }
+        head.store(h + n, memory_order_release);
+        return n;
+    }
+
+    // Consumer side: copy up to n bytes out, returns how many were available
+    size_t read (unsigned char* dst, size_t n)
+    {
+        size_t t = tail.load(memory_order_relaxed);
+        size_t h = head.load(memory_order_acquire);
+        if(n > h - t)
+          n = h - t;
+        for(size_t k = 0; k < n; )
+        {
+          size_t at = (t + k) & mask;
+          size_t run = min(n - k, data.size() - at);
+          memcpy(dst + k, &data[at], run);
+          k += run;
+        }
+        tail.store(t + n, memory_order_release);
+        return n;
+    }
+};
+
+// 64 KiB is ~0.37 s of 44.1 kHz 16-bit stereo - enough to ride out decoder hiccups
+static AudioRing ring(1 << 16);
+static const size_t CHUNK = 4096;
+
+static bool initialized = false;
+static mpg123_handle *mh = NULL;
+static ao_device *dev = NULL;
+static atomic<bool> running(false);
+static thread *decoderThread = NULL, *deviceThread = NULL;
+static int numChannels = 2;
+
+/* Sound effect clips, 16-bit interleaved at the music's rate and channel count.
+   audioPlaySfx() only bumps sfxRequests; the device thread compares against
+   sfxStarted and starts a voice for each new request. */
+static vector<short> sfxClip[NUM_SFX];
+static atomic<unsigned> sfxRequests[NUM_SFX];
+static unsigned sfxStarted[NUM_SFX];
+
+struct Voice {
+    int clip;       // -1 when free
+    size_t pos;     // next sample in the clip
+};
+#define MAX_VOICES 8
+static Voice voices[MAX_VOICES];
+
+// Short decaying sine - the in-process replacement for the terminal bell
+static void buildTone (vector<short> &clip, long rate, float freq, float seconds)
+{
+    int frames = rate * seconds;
+    clip.resize(frames * numChannels);
+    for(int f = 0; f < frames; f++)
+    {
+      float t = (float)f / rate;
+      float envelope = 1.0f - (float)f / frames;
+      short v = (short)(9000 * envelope * envelope * sin(2 * M_PI * freq * t));
+      for(int c = 0; c < numChannels; c++)
+        clip[f*numChannels + c] = v;
+    }
+}
+
+void audioPlaySfx (SoundEffect sfx)
+{
+    sfxRequests[sfx].fetch_add(1, memory_order_relaxed);
+}
+
+/* Start voices for new requests and add every active voice onto samples, saturating */
+static bool mixSfx (short* samples, size_t count)
+{
+    for(int s = 0; s < NUM_SFX; s++)
+    {
+      unsigned requested = sfxRequests[s].load(memory_order_relaxed);
+      for(; sfxStarted[s] != requested; sfxStarted[s]++)
+        for(int v = 0; v < MAX_VOICES; v++)
+          if(voices[v].clip < 0)
+          {
+            voices[v].clip = s;
+            voices[v].pos = 0;
+            break;
+          }
+    }
+
+    bool active = false;
+    for(int v = 0; v < MAX_VOICES; v++)
+    {
+      if(voices[v].clip < 0)
+        continue;
+      const vector<short> &clip = sfxClip[voices[v].clip];
+      size_t n = min(count, clip.size() - voices[v].pos);
+      for(size_t k = 0; k < n; k++)
+      {
+        int mixed = samples[k] + clip[voices[v].pos + k];
+        samples[k] = (short)max(-32768, min(32767, mixed));
+      }
+      voices[v].pos += n;
+      if(voices[v].pos >= clip.size())
+        voices[v].clip = -1;
+      active = true;
+    }
+    return active;
+}
+
+/* Decode the track into the ring, looping from the start when it ends */
+static void decodeLoop ()
+{
+    traceThreadName("audio decoder");
+    unsigned char buffer[CHUNK];
+    while(running)
+    {
+      size_t done = 0;
+      int err;
+      {
+        TRACE_SCOPE("mpg123_read");
+        err = mpg123_read(mh, buffer, CHUNK, &done);
+      }
+      if(err != MPG123_OK && done == 0)
+      {
+        mpg123_seek(mh, 0, SEEK_SET); // loop audio from start again if ended
+        continue;
+      }
+
+      size_t written = 0;
+      while(running && written < done)
+      {
+        written += ring.write(buffer + written, done - written);
+        if(written < done)
+          this_thread::sleep_for(chrono::milliseconds(5)); // ring full - the device is behind
+      }
+    }
+}
+
+/* Pre-decoded music - the whole track as 16-bit PCM, memory-mapped from the cache
+   file next to the binary, or held in pcmMemory when the cache can't be written.
+   streamLoop() then replaces decodeLoop() and the steady state does no decoding. */
+struct PcmCacheHeader {
+    char magic[8];          // "BLXPCM1"
+    uint64_t hash;          // FNV-1a of the mp3 the samples were decoded from
+    int32_t rate;
+    int32_t channels;
+    uint64_t bytes;         // PCM bytes following the header
+};
+
+static const unsigned char* pcmData = NULL;
+static size_t pcmBytes = 0;
+static void* pcmMapping = NULL;
+static size_t pcmMappingSize = 0;
+static vector<unsigned char> pcmMemory;
+
+static bool readFile (const char* path, vector<unsigned char> &out)
+{
+    FILE* f = fopen(path, "rb");
+    if(f == NULL)
+      return false;
+    unsigned char chunk[1 << 16];
+    size_t n;
+    while((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+      out.insert(out.end(), chunk, chunk + n);
+    fclose(f);
+    return true;
+}
+
+static uint64_t fnv1a (const vector<unsigned char> &bytes)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for(size_t k = 0; k < bytes.size(); k++)
+    {
+      h ^= bytes[k];
+      h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Map a cache file and check it was decoded from the mp3 with this hash
+static bool mapPcmCache (const string &cachePath, uint64_t hash, long &rate, int &channels)
+{
+    int fd = open(cachePath.c_str(), O_RDONLY);
+    if(fd < 0)
+      return false;
+    struct stat st;
+    void* map = MAP_FAILED;
+    if(fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(PcmCacheHeader))
+      map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+      return false;
+
+    /* A damaged or foreign cache is decoded over. The format is checked as well as the size -
+       the device loop divides by the channel count and the frame size must divide the data. */
+    const PcmCacheHeader* header = (const PcmCacheHeader*)map;
+    if(memcmp(header->magic, "BLXPCM1", 8) != 0 || header->hash != hash ||
+       header->bytes != (uint64_t)st.st_size - sizeof(PcmCacheHeader) || header->bytes == 0 ||
+       (header->channels != 1 && header->channels != 2) || header->rate <= 0 ||
+       header->bytes % (header->channels * sizeof(short)) != 0)
+    {
+      munmap(map, st.st_size);
+      return false;
+    }
+    pcmMapping = map;
+    pcmMappingSize = st.st_size;
+    pcmData = (const unsigned char*)map + sizeof(PcmCacheHeader);
+    pcmBytes = header->bytes;
+    rate = header->rate;
+    channels = header->channels;
+    return true;
+}
+
+static bool openDecoder (const char* path, long &rate, int &channels)
+{
+    int err, encoding;
+    mh = mpg123_new(NULL, &err);
+
+    /* open the file and get the decoding format */
+    if(mh == NULL || mpg123_open(mh, path) != MPG123_OK || mpg123_getformat(mh, &rate, &channels, &encoding) != MPG123_OK)
+    {
+      fprintf(stderr, "Audio: cannot decode %s\n", path);
+      if(mh)
+      {
+        mpg123_delete(mh);
+        mh = NULL;
+      }
+      return false;
+    }
+    // Always decode to 16-bit signed so effects can be mixed in sample by sample
+    mpg123_format_none(mh);
+    mpg123_format(mh, rate, channels, MPG123_ENC_SIGNED_16);
+    return true;
+}
+
+/* Decode the whole track once and keep it - from the cache file when one matches,
+   otherwise decode now and try to write the cache for the next run */
+static bool loadPcm (const char* path, const char* cacheDir, long &rate, int &channels)
+{
+    vector<unsigned char> mp3;
+    if(!readFile(path, mp3))
+      return false;
+    uint64_t hash = fnv1a(mp3);
+    const char* name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%016llx.pcm", (unsigned long long)hash);
+    string cachePath = string(cacheDir) + "/" + name + suffix;
+
+    if(mapPcmCache(cachePath, hash, rate, channels))
+      return true;
+
+    if(!openDecoder(path, rate, channels))
+      return false;
+    unsigned char buffer[CHUNK];
+    size_t done = 0;
+    int err;
+    while((err = mpg123_read(mh, buffer, CHUNK, &done)) == MPG123_OK || done > 0)
+    {
+      pcmMemory.insert(pcmMemory.end(), buffer, buffer + done);
+      if(err != MPG123_OK)
+        break;
+    }
+    mpg123_close(mh);
+    mpg123_delete(mh);
+    mh = NULL;
+    if(pcmMemory.empty())
+      return false;
+
+    PcmCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "BLXPCM1", 8);
+    header.hash = hash;
+    header.rate = rate;
+    header.channels = channels;
+    header.bytes = pcmMemory.size();
+
+    // Write under a temporary name so a half-written cache is never picked up
+    string tempPath = cachePath + ".tmp";
+    FILE* f = fopen(tempPath.c_str(), "wb");
+    bool written = f != NULL &&
+                   fwrite(&header, sizeof(header), 1, f) == 1 &&
+                   fwrite(&pcmMemory[0], 1, pcmMemory.size(), f) == pcmMemory.size();
+    if(f != NULL && fclose(f) != 0)
+      written = false;
+    if(written && rename(tempPath.c_str(), cachePath.c_str()) == 0 && mapPcmCache(cachePath, hash, rate, channels))
+    {
+      vector<unsigned char>().swap(pcmMemory);
+      return true;
+    }
+    remove(tempPath.c_str());
+    fprintf(stderr, "Audio: cannot write %s, keeping decoded music in memory\n", cachePath.c_str());
+    pcmData = &pcmMemory[0];
+    pcmBytes = pcmMemory.size();
+    return true;
+}
+
+/* Stream the pre-decoded track into the ring, looping - no decoding involved */
+static void streamLoop ()
+{
+    traceThreadName("audio stream");
+    size_t pos = 0;
+    while(running)
+    {
+      size_t n = min(CHUNK, pcmBytes - pos);
+      size_t written = ring.write(pcmData + pos, n);
+      pos += written;
+      if(pos == pcmBytes)
+        pos = 0;
+      if(written < n)
+        this_thread::sleep_for(chrono::milliseconds(5)); // ring full - the device is behind
+    }
+}
+
+/* Feed the device from the ring with sound effects mixed in -
+   ao_play blocking here only ever stalls this thread */
+static void deviceLoop ()
+{
+    traceThreadName("audio device");
+    short samples[CHUNK / sizeof(short)];
+    unsigned char* buffer = (unsigned char*)samples;
+    while(running)
+    {
+      size_t got = ring.read(buffer, CHUNK);
+      got -= got % (numChannels * sizeof(short));
+      if(got == 0)
+      {
+        // Underrun - keep effects audible over silence, otherwise wait for the decoder
+        memset(samples, 0, 512 * numChannels * sizeof(short));
+        if(mixSfx(samples, 512 * numChannels))
+          ao_play(dev, (char *)buffer, 512 * numChannels * sizeof(short));
+        else
+          this_thread::sleep_for(chrono::milliseconds(1));
+        continue;
+      }
+      TRACE_SCOPE("audio pump");
+      mixSfx(samples, got / sizeof(short));
+      ao_play(dev, (char *)buffer, got);
+    }
+}
+
+bool audioStart (const char* path, const char* pcmCacheDir)
+{
+    int channels, encoding = MPG123_ENC_SIGNED_16;
+    long rate;
+    ao_sample_format format;
+
+    /* initializations */
+    ao_initialize();
+    mpg123_init();
+    initialized = true;
+
+    if(pcmCacheDir != NULL && !loadPcm(path, pcmCacheDir, rate, channels))
+      fprintf(stderr, "Audio: no PCM cache for %s, decoding while playing\n", path);
+    if(pcmData == NULL && !openDecoder(path, rate, channels))
+    {
+      audioStop();
+      return false;
+    }
+    numChannels = channels;
+
+    /* set the output format and open the output device */
+    memset(&format, 0, sizeof(format));
+    format.bits = mpg123_encsize(encoding) * BITS;
+    format.rate = rate;
+    format.channels = channels;
+    format.byte_format = AO_FMT_NATIVE;
+    format.matrix = 0;
+    dev = ao_open_live(ao_default_driver_id(), &format, NULL);
+    if(dev == NULL)
+    {
+      fprintf(stderr, "Audio: no output device\n");
+      audioStop();
+      return false;
+    }
+
+    buildTone(sfxClip[SFX_MOVE], rate, 880, 0.06);
+    for(int s = 0; s < NUM_SFX; s++)
+      sfxStarted[s] = sfxRequests[s].load();
+    for(int v = 0; v < MAX_VOICES; v++)
+      voices[v].clip = -1;
+
+    running = true;
+    decoderThread = new thread(pcmData ? streamLoop : decodeLoop);
+    deviceThread = new thread(deviceLoop);
+    // exit() is called from several places in the game - make sure the threads are joined first
+    static bool registered = false;
+    if(!registered)
+    {
+      atexit(audioStop);
+      registered = true;
+    }
+    return true;
+}
+
+void audioStop ()
+{
+    running = false;
+    if(decoderThread)
+    {
+      decoderThread->join();
+      delete decoderThread;
+      decoderThread = NULL;
+    }
+    if(deviceThread)
+    {
+      deviceThread->join();
+      delete deviceThread;
+      deviceThread = NULL;
+    }
+    if(dev)
+    {
+      ao_close(dev);
+      dev = NULL;
+    }
+    if(mh)
+    {
+      mpg123_close(mh);
+      mpg123_delete(mh);
+      mh = NULL;
+    }
+    if(pcmMapping)
+    {
+      munmap(pcmMapping, pcmMappingSize);
+      pcmMapping = NULL;
+    }
+    pcmData = NULL;
+    pcmBytes = 0;
+    vector<unsigned char>().swap(pcmMemory);
+    if(initialized)
+    {
+      mpg123_exit();
+      ao_shutdown();
+      initialized = false;
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+/* Background music - decoded and played on dedicated threads, so the render
+   loop never touches mpg123 or libao and device latency can't stall a frame */
+
+// Start looping the mp3 at path. Returns false if no audio device could be opened.
+// With pcmCacheDir the track is decoded once into a PCM cache file in that directory,
+// keyed by the mp3's hash, and later runs stream straight from the memory-mapped cache.
+bool audioStart (const char* path, const char* pcmCacheDir = NULL);
+
+// Stop the audio threads and release the decoder and device. Safe to call twice.
+void audioStop ();
+
+/* Sound effects - clips are built in memory by audioStart() and mixed over the music
+   on the device thread. Triggering is one atomic increment: no allocation, no syscall. */
+enum SoundEffect {
+    SFX_MOVE,       // block starts a roll
+    NUM_SFX
+};
+
+void audioPlaySfx (SoundEffect sfx);
+
+#endif
@@ -0,0 +1,472 @@
+#include <algorithm>
+#include <stddef.h>
+
+#include "Game.h"
+
+using namespace std;
+
+void finishLevel (Level& level)
+{
+    level.fragX.clear();
+    level.fragY.clear();
+    for(int y = 0; y < level.height; y++)
+      for(int x = 0; x < level.width; x++)
+        if(levelTile(level, x, y) == TILE_FRAGILE)
+        {
+          level.fragX.push_back(x);
+          level.fragY.push_back(y);
+        }
+    indexLevel(level);
+}
+
+Level generateLevel (int width, int height, unsigned seed)
+{
+    Level level;
+    level.name = "generated";
+    level.width = width;
+    level.height = height;
+    level.packCells = NULL;
+    level.cells.assign(width * height, TILE_FLOOR);
+    for(int c = 0; c < width * height; c++)
+    {
+      seed = seed * 1103515245 + 12345;
+      if((seed >> 16) % 100 < 8)
+        level.cells[c] = TILE_EMPTY;
+    }
+    level.startX = level.startY = 1;
+    level.goalX = width - 2;
+    level.goalY = height - 2;
+    level.cells[level.startY * width + level.startX] = TILE_FLOOR;
+    level.cells[level.goalY * width + level.goalX] = TILE_GOAL;
+    finishLevel(level);
+    return level;
+}
+
+void indexLevel (Level& level)
+{
+    level.specialAt.clear();
+    for(int j = 0; j < (int)level.switches.size(); j++)
+      level.specialAt[level.switches[j].y * level.width + level.switches[j].x] = j;
+    for(int j = 0; j < (int)level.teleporters.size(); j++)
+    {
+      const Teleporter& t = level.teleporters[j];
+      level.specialAt[t.ay * level.width + t.ax] = j;
+      level.specialAt[t.by * level.width + t.bx] = j;
+    }
+}
+
+// Index of the switch group or teleporter at (x,y), -1 if the level has none there
+static int specialIndex (const Level& lvl, int x, int y)
+{
+    unordered_map<int,int>::const_iterator it = lvl.specialAt.find(y * lvl.width + x);
+    return it == lvl.specialAt.end() ? -1 : it->second;
+}
+
+GameState newGame (const vector<Level>& levels, int lives)
+{
+    GameState state;
+    state.levels = &levels;
+    state.lives = lives;
+    loadLevel(state, 0);
+    return state;
+}
+
+/* State key of the block in a level: (dyn*3 + orientation-1) * cells + cell. cell is the
+   block's lower cell on the grid padded by two all round, so a block that rolled off the
+   edge still has one; dyn is the toggled bits of the switch groups, then one bit per
+   fragile tile broken.
+   -1 when the block is further out than the padding. */
+static int64_t stateKey (const Level& lvl, const GameState& s)
+{
+    int cols = lvl.width + 4, rows = lvl.height + 4;
+    int x = min(s.x1, s.x2) + 2, y = min(s.y1, s.y2) + 2;
+    if(x < 0 || x >= cols || y < 0 || y >= rows)
+      return -1;
+    int numSwitches = lvl.switches.size();
+    int64_t dyn = s.toggled;
+    for(int k = 0; k < (int)lvl.fragX.size(); k++)
+      if(tileAt(s, lvl.fragX[k], lvl.fragY[k]) == TILE_EMPTY && levelTile(lvl, lvl.fragX[k], lvl.fragY[k]) != TILE_EMPTY)
+        dyn |= (int64_t)1 << (numSwitches + k);
+    return (dyn * 3 + s.orientation - 1) * (cols * rows) + y * cols + x;
+}
+
+// Put the block where key says - the tiles are left alone
+static void setCells (const Level& lvl, GameState& s, int64_t key)
+{
+    int cols = lvl.width + 4, cells = cols * (lvl.height + 4);
+    int cell = key % cells;
+    s.orientation = (key / cells) % 3 + 1;
+    s.x1 = s.x2 = cell % cols - 2;
+    s.y1 = s.y2 = cell / cols - 2;
+    if(s.orientation == LYING_X)
+      s.x1++;
+    else if(s.orientation == LYING_Y)
+      s.y2++;
+}
+
+static int graphNode (const GameState& s)
+{
+    const Level& lvl = (*s.levels)[s.level];
+    if(lvl.graph.edges.empty())
+      return -1;
+    unordered_map<int64_t,int>::const_iterator it = lvl.graph.nodeOf.find(stateKey(lvl, s));
+    return it == lvl.graph.nodeOf.end() ? -1 : it->second;
+}
+
+void toggleBridges (GameState& s, const vector<SwitchGroup>& switches, int j)
+{
+    const SwitchGroup& sw = switches[j];
+    for(int k = 0; k < (int)sw.bridgeX.size(); k++)
+    {
+      unsigned char &t = s.tiles[sw.bridgeY[k] * s.width + sw.bridgeX[k]];
+      t = t == TILE_EMPTY ? TILE_BRIDGE : TILE_EMPTY;
+    }
+    if(j < 64)
+      s.toggled ^= (uint64_t)1 << j;
+}
+
+// Make the dynamic tiles match the dyn bits of a state key, from whatever dyn bits they match now
+static void applyDyn (GameState& s, const Level& lvl, int64_t from, int64_t to)
+{
+    int64_t changed = from ^ to;
+    int numSwitches = lvl.switches.size();
+    for(int j = 0; j < numSwitches; j++)
+      if(changed & ((int64_t)1 << j))
+        toggleBridges(s, lvl.switches, j);
+    for(int k = 0; k < (int)lvl.fragX.size(); k++)
+      if(changed & ((int64_t)1 << (numSwitches + k)))
+        s.tiles[lvl.fragY[k] * s.width + lvl.fragX[k]] = (to >> (numSwitches + k)) & 1 ? TILE_EMPTY : levelTile(lvl, lvl.fragX[k], lvl.fragY[k]);
+}
+
+// Dyn bits of a state key
+static int64_t keyDyn (const Level& lvl, int64_t key)
+{
+    return key / ((lvl.width + 4) * (lvl.height + 4)) / 3;
+}
+
+// Live grid back to the level's initial tiles
+static void resetTiles (GameState& state, const Level& lvl)
+{
+    const unsigned char* cells = levelCells(lvl);
+    state.width = lvl.width;
+    state.height = lvl.height;
+    state.tiles.assign(cells, cells + lvl.width * lvl.height);
+    state.toggled = 0;
+}
+
+/* dyn is the state key's dyn bits for the tiles as they are, which picks the node from
+   startOf without hashing the key; -1 when not known */
+static void placeAtStart (GameState& state, int64_t dyn)
+{
+    const Level& lvl = (*state.levels)[state.level];
+    state.x1 = state.x2 = lvl.startX;
+    state.y1 = state.y2 = lvl.startY;
+    state.orientation = STANDING;
+    state.teleported = false;
+    state.status = PLAYING;
+    if(lvl.graph.edges.empty())
+      state.node = -1;
+    else if(dyn >= 0)
+      state.node = lvl.graph.startOf[dyn];
+    else
+      state.node = graphNode(state);
+}
+
+void loadLevel (GameState& state, int level)
+{
+    state.level = level;
+    resetTiles(state, (*state.levels)[level]);
+    state.moves = 0;
+    placeAtStart(state, 0);
+}
+
+void respawn (GameState& state)
+{
+    if(state.status != FALLING)
+      return;
+    state.moves = 0;
+    state.lives--;
+    // The fall's terminal node keeps the tiles' dyn bits
+    const Level& lvl = (*state.levels)[state.level];
+    placeAtStart(state, state.node >= 0 ? keyDyn(lvl, lvl.graph.keyOf[state.node]) : -1);
+    if(state.lives < 0)
+      state.status = GAME_OVER;
+}
+
+// Roll the block - new cells and orientation only, no tile rules
+static void roll (GameState& s, Move move)
+{
+    switch(s.orientation)
+    {
+    case STANDING:
+        if(move == MOVE_LEFT)       { s.orientation = LYING_X; s.x2 = s.x1 - 2; s.x1 -= 1; }
+        else if(move == MOVE_RIGHT) { s.orientation = LYING_X; s.x2 = s.x1 + 1; s.x1 += 2; }
+        else if(move == MOVE_UP)    { s.orientation = LYING_Y; s.y1 += 1; s.y2 = s.y1 + 1; }
+        else                        { s.orientation = LYING_Y; s.y1 -= 2; s.y2 = s.y1 + 1; }
+        break;
+    case LYING_X:
+        if(move == MOVE_LEFT)       { s.orientation = STANDING; s.x1 = s.x2 = s.x2 - 1; }
+        else if(move == MOVE_RIGHT) { s.orientation = STANDING; s.x1 = s.x2 = s.x1 + 1; }
+        else if(move == MOVE_UP)    { s.y1++; s.y2++; }
+        else                        { s.y1--; s.y2--; }
+        break;
+    case LYING_Y:
+        if(move == MOVE_LEFT)       { s.x1--; s.x2--; }
+        else if(move == MOVE_RIGHT) { s.x1++; s.x2++; }
+        else if(move == MOVE_UP)    { s.orientation = STANDING; s.y1 = s.y2 = s.y2 + 1; }
+        else                        { s.orientation = STANDING; s.y1 = s.y2 = s.y1 - 1; }
+        break;
+    }
+}
+
+static int settle (GameState& s);
+
+static int pressSwitch (GameState& s, const Level& lvl, int x, int y)
+{
+    int j = specialIndex(lvl, x, y);
+    if(j < 0)
+      return 0;
+    toggleBridges(s, lvl.switches, j);
+    return EV_SWITCH;
+}
+
+static int pressHeavySwitch (GameState& s, const Level& lvl, int x, int y)
+{
+    return s.orientation == STANDING ? pressSwitch(s, lvl, x, y) : 0;
+}
+
+int pressedSwitch (const GameState& s, int x, int y)
+{
+    int t = tileAt(s, x, y);
+    if(t != TILE_SWITCH && (t != TILE_HEAVY_SWITCH || s.orientation != STANDING))
+      return -1;
+    return specialIndex((*s.levels)[s.level], x, y);
+}
+
+static int breakFragile (GameState& s, const Level& lvl, int x, int y)
+{
+    s.tiles[y * s.width + x] = TILE_EMPTY;
+    s.status = FALLING;
+    return EV_FRAGILE | EV_FELL;
+}
+
+static int teleport (GameState& s, const Level& lvl, int x, int y)
+{
+    int j = specialIndex(lvl, x, y);
+    if(s.teleported || j < 0)
+      return 0;
+    const Teleporter& t = lvl.teleporters[j];
+    bool fromA = x == t.ax && y == t.ay;
+    s.x1 = s.x2 = fromA ? t.bx : t.ax;
+    s.y1 = s.y2 = fromA ? t.by : t.ay;
+    s.teleported = true;
+    // The destination is checked like any other landing spot
+    return EV_TELEPORT | settle(s);
+}
+
+static int reachGoal (GameState& s, const Level& lvl, int x, int y)
+{
+    if(s.level + 1 < (int)s.levels->size())
+    {
+      loadLevel(s, s.level + 1);
+      return EV_LEVEL;
+    }
+    s.status = WON;
+    return EV_WON;
+}
+
+/* What each tile type does, indexed by TileType. pressed runs for every cell the block lands
+   on, before it is checked for support; stood runs for the cell a standing block comes to
+   rest on. Either may be NULL. Both return StepEvent flags. */
+struct TileRule {
+    bool solid;         // holds the block up
+    int (*pressed) (GameState& s, const Level& lvl, int x, int y);
+    int (*stood) (GameState& s, const Level& lvl, int x, int y);
+};
+
+static const TileRule tileRules[NUM_TILE_TYPES] = {
+    {false, NULL,             NULL},            // TILE_EMPTY
+    {true,  NULL,             NULL},            // TILE_FLOOR
+    {true,  NULL,             breakFragile},    // TILE_FRAGILE
+    {true,  pressSwitch,      NULL},            // TILE_SWITCH
+    {true,  NULL,             teleport},        // TILE_TELEPORT
+    {true,  NULL,             reachGoal},       // TILE_GOAL
+    {true,  pressHeavySwitch, NULL},            // TILE_HEAVY_SWITCH
+    {true,  NULL,             NULL},            // TILE_BRIDGE
+};
+
+static int press (GameState& s, const Level& lvl, int x, int y)
+{
+    const TileRule& rule = tileRules[tileAt(s, x, y)];
+    return rule.pressed ? rule.pressed(s, lvl, x, y) : 0;
+}
+
+// Tile rules for where the block now rests. Returns the events it caused.
+static int settle (GameState& s)
+{
+    const Level& lvl = (*s.levels)[s.level];
+
+    // A standing block needs its tile, a lying block only falls once both halves are off
+    bool supported = tileRules[tileAt(s, s.x1, s.y1)].solid
+                     || (s.orientation != STANDING && tileRules[tileAt(s, s.x2, s.y2)].solid);
+    if(!supported)
+    {
+      s.status = FALLING;
+      return EV_FELL;
+    }
+    if(s.orientation != STANDING)
+      return 0;
+
+    const TileRule& rule = tileRules[tileAt(s, s.x1, s.y1)];
+    return rule.stood ? rule.stood(s, lvl, s.x1, s.y1) : 0;
+}
+
+// One move along the compiled graph - the edge says where the block ends up and what happened
+static int stepGraph (GameState& s, const Level& lvl, Move move)
+{
+    uint32_t edge = lvl.graph.edges[s.node * NUM_MOVES + move];
+    int events = edge >> GRAPH_EVENT_SHIFT;
+    int64_t from = lvl.graph.keyOf[s.node];
+    s.node = edge & GRAPH_NODE_MASK;
+    int64_t to = lvl.graph.keyOf[s.node];
+    setCells(lvl, s, to);
+    s.teleported = (events & EV_TELEPORT) != 0;
+    // Bridges toggled and tiles broken are whatever differs between the two states
+    if(events & (EV_SWITCH | EV_FRAGILE))
+      applyDyn(s, lvl, keyDyn(lvl, from), keyDyn(lvl, to));
+    if(events & EV_FELL)
+      s.status = FALLING;
+    if(events & EV_LEVEL)
+      loadLevel(s, s.level + 1);
+    else if(events & EV_WON)
+      s.status = WON;
+    return events;
+}
+
+int step (GameState& s, Move move)
+{
+    if(s.status != PLAYING)
+      return 0;
+    s.moves++;
+    const Level& lvl = (*s.levels)[s.level];
+    if(s.node >= 0)
+      return stepGraph(s, lvl, move);
+
+    s.teleported = false;
+    roll(s, move);
+
+    int events = EV_MOVED | press(s, lvl, s.x1, s.y1);
+    if(s.x2 != s.x1 || s.y2 != s.y1)
+      events |= press(s, lvl, s.x2, s.y2);
+    return events | settle(s);
+}
+
+/* Walk every state reachable from the start - falls respawn there with the tiles as they
+   are - and record each move's outcome as the rules compute it */
+LevelGraph buildLevelGraph (const vector<Level>& levels, int level)
+{
+    const Level& lvl = levels[level];
+    LevelGraph g;
+    if(lvl.switches.size() + lvl.fragX.size() > GRAPH_MAX_DYN_BITS)
+      return g;
+    // Block positions alone could outnumber the node ids - huge levels stay on the rules
+    if((int64_t)3 * (lvl.width + 4) * (lvl.height + 4) > GRAPH_NODE_MASK)
+      return g;
+
+    /* Play the level on its own and without a graph, so step() applies the rules and never
+       reads another level - a graph may be installed into one meanwhile. Alone, its goal
+       reports EV_WON, which is EV_LEVEL when a level follows. */
+    vector<Level> solo(1);
+    Level& view = solo[0];
+    view.name = lvl.name;
+    view.width = lvl.width;
+    view.height = lvl.height;
+    view.packCells = levelCells(lvl);
+    view.startX = lvl.startX;
+    view.startY = lvl.startY;
+    view.goalX = lvl.goalX;
+    view.goalY = lvl.goalY;
+    view.teleporters = lvl.teleporters;
+    view.switches = lvl.switches;
+    view.fragX = lvl.fragX;
+    view.fragY = lvl.fragY;
+    view.specialAt = lvl.specialAt;
+    bool last = level + 1 == (int)levels.size();
+
+    GameState s = newGame(solo, 0);
+    vector<char> terminal;
+
+    int64_t startKey = stateKey(lvl, s);
+    g.nodeOf[startKey] = 0;
+    g.keyOf.push_back(startKey);
+    terminal.push_back(0);
+    g.startOf.assign((size_t)1 << (lvl.switches.size() + lvl.fragX.size()), -1);
+    g.startOf[0] = 0;
+
+    for(int head = 0; head < (int)g.keyOf.size(); head++)
+    {
+      if(terminal[head])
+      {
+        g.edges.insert(g.edges.end(), NUM_MOVES, (uint32_t)head);
+        continue;
+      }
+      int64_t dyn = keyDyn(lvl, g.keyOf[head]);
+      for(int m = 0; m < NUM_MOVES; m++)
+      {
+        // Load the node - the scratch tiles are the level's own between moves
+        setCells(lvl, s, g.keyOf[head]);
+        s.status = PLAYING;
+        applyDyn(s, lvl, 0, dyn);
+
+        int events = step(s, (Move)m);
+        if((events & EV_WON) && !last)
+          events ^= EV_WON | EV_LEVEL;
+        int64_t landed = stateKey(lvl, s);
+        int64_t key = (events & EV_LEVEL) ? g.keyOf[head] : landed;
+        int64_t respawnKey = -1;
+        if(events & EV_FELL)
+        {
+          respawn(s);
+          respawnKey = stateKey(lvl, s);
+        }
+        if(key < 0 || g.keyOf.size() > GRAPH_MAX_NODES)
+          return LevelGraph();   // off the padded grid or too big - leave the level uncompiled
+
+        int target;
+        if(g.nodeOf.count(key))
+          target = g.nodeOf[key];
+        else
+        {
+          target = g.nodeOf[key] = g.keyOf.size();
+          g.keyOf.push_back(key);
+          terminal.push_back((events & (EV_FELL | EV_LEVEL | EV_WON)) != 0);
+        }
+        if(respawnKey >= 0)
+        {
+          if(!g.nodeOf.count(respawnKey))
+          {
+            g.nodeOf[respawnKey] = g.keyOf.size();
+            g.keyOf.push_back(respawnKey);
+            terminal.push_back(0);
+          }
+          g.startOf[keyDyn(lvl, respawnKey)] = g.nodeOf[respawnKey];
+        }
+        g.edges.push_back((uint32_t)target | ((uint32_t)events << GRAPH_EVENT_SHIFT));
+
+        // Back to the level's own tiles for the next move
+        applyDyn(s, lvl, keyDyn(lvl, landed), 0);
+      }
+    }
+    return g;
+}
+
+void compileLevel (vector<Level>& levels, int level)
+{
+    levels[level].graph = buildLevelGraph(levels, level);
+}
+
+void attachGraph (GameState& state)
+{
+    if(state.node < 0 && state.status == PLAYING)
+      state.node = graphNode(state);
+}
@@ -0,0 +1,177 @@
+#ifndef GAME_H
+#define GAME_H
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/* Headless Bloxorz rules - no GLFW or GL in here. The renderer in Sample_GL3_2D.cpp
+   only reads a GameState and animates the events step() reports.
+   There is no global state: a GameState only points at its (read-only) levels, so any
+   number of games can live in one process and be stepped on separate threads. */
+
+// Tile types as stored in the level grids. What each one does is its entry in the
+// tileRules table in Game.cpp, so a new type is a new row there.
+enum TileType {
+    TILE_EMPTY = 0,
+    TILE_FLOOR = 1,
+    TILE_FRAGILE = 2,   // breaks under a standing block
+    TILE_SWITCH = 3,    // soft switch - toggles its group's bridges when any part of the block lands on it
+    TILE_TELEPORT = 4,  // standing on one end of the pair moves the block to the other
+    TILE_GOAL = 5,
+    TILE_HEAVY_SWITCH = 6,  // toggles its group's bridges only under a standing block
+    TILE_BRIDGE = 7,    // floor a switch group takes away and puts back, TILE_EMPTY while it is gone
+    NUM_TILE_TYPES
+};
+
+// Block orientation, same numbering as Block::state
+enum Orientation {
+    STANDING = 1,
+    LYING_X = 2,        // along the columns, cells (x2,y) (x1,y) with x1 = x2 + 1
+    LYING_Y = 3         // along the rows, cells (x,y1) (x,y2) with y2 = y1 + 1
+};
+
+enum Move {
+    MOVE_LEFT,          // column - 1
+    MOVE_RIGHT,         // column + 1
+    MOVE_UP,            // row + 1
+    MOVE_DOWN,          // row - 1
+    NUM_MOVES
+};
+
+// What happened during a step, OR-ed together
+enum StepEvent {
+    EV_MOVED = 1,
+    EV_SWITCH = 2,      // bridges toggled
+    EV_TELEPORT = 4,
+    EV_FRAGILE = 8,     // a fragile tile broke
+    EV_FELL = 16,       // the block is falling, call respawn() once the fall has been shown
+    EV_LEVEL = 32,      // goal reached, the next level is loaded
+    EV_WON = 64         // goal of the last level reached
+};
+
+enum GameStatus {
+    PLAYING,
+    FALLING,
+    WON,
+    GAME_OVER
+};
+
+/* A level's moves compiled ahead of time by compileLevel(). Every state the block can be in -
+   its cells, orientation, which switch groups are toggled and which fragile tiles are broken -
+   is a node. Each node has exactly one edge per Move, so this is CSR adjacency with implicit
+   offsets (node * NUM_MOVES) and a move is one indexed load. Falls and goals lead to terminal
+   nodes, which only exist so the block's cells are known; step() never leaves them. */
+#define GRAPH_NODE_MASK 0xFFFFFF     // edge = target node | StepEvent flags << GRAPH_EVENT_SHIFT
+#define GRAPH_EVENT_SHIFT 24
+#define GRAPH_MAX_DYN_BITS 10        // levels with more switches + fragile tiles than this stay uncompiled
+#define GRAPH_MAX_NODES (1 << 20)    // and so do levels with more reachable states - they would take too long to build
+
+struct LevelGraph {
+    std::vector<uint32_t> edges;                 // node*NUM_MOVES + move
+    std::vector<int64_t> keyOf;                  // node -> state key, see stateKey() in Game.cpp
+    std::unordered_map<int64_t,int> nodeOf;      // state key -> node, only used when a graph is attached mid-level
+    std::vector<int> startOf;                    // dyn bits -> node of the block standing on the start tile, -1 if never reached
+};
+
+// Standing on either end moves the block to the other
+struct Teleporter {
+    int ax, ay, bx, by;
+};
+
+// Pressing the switch at (x,y) toggles every bridge cell between empty and bridge
+struct SwitchGroup {
+    int x, y;
+    std::vector<int> bridgeX, bridgeY;
+};
+
+struct Level {
+    std::string name;
+    int width, height;
+    const unsigned char* packCells;          // width*height TileType bytes, row-major, read in place from a LevelPack
+    std::vector<unsigned char> cells;        // the same bytes owned by the level, used instead when not empty
+    int startX, startY;
+    int goalX, goalY;
+    std::vector<Teleporter> teleporters;
+    std::vector<SwitchGroup> switches;
+    std::vector<int> fragX, fragY;           // every TILE_FRAGILE cell, filled by finishLevel()
+    std::unordered_map<int,int> specialAt;   // y*width + x -> index into switches or teleporters, see indexLevel()
+    LevelGraph graph;                        // empty until compileLevel(), step() then uses the rules directly
+};
+
+struct GameState {
+    const std::vector<Level>* levels;
+    int level;                               // index into levels
+    std::vector<unsigned char> tiles;        // live grid, row-major like levelCells() - bridges and broken tiles change it
+    int width, height;                       // of the live grid, the current level's size
+    int x1, y1, x2, y2;                      // block cells, (x2,y2) == (x1,y1) while standing
+    int orientation;
+    bool teleported;                         // no teleporting back until the next move
+    int moves;                               // moves since the last fall, shown as the score
+    int lives;
+    int status;
+    int node;                                // node in the level's graph, -1 to apply the rules move by move
+    uint64_t toggled;                        // bit j: switch group j pressed an odd number of times - groups may share bridge cells, so the tiles can't tell
+};
+
+// A level's initial tiles, one TileType byte per cell, row-major
+inline const unsigned char* levelCells (const Level& level)
+{
+    return level.cells.empty() ? level.packCells : &level.cells[0];
+}
+
+// Initial tile at (x,y), which must be inside the level
+inline int levelTile (const Level& level, int x, int y)
+{
+    return levelCells(level)[y * level.width + x];
+}
+
+// Fill in what a level file leaves implicit - the fragile cell list, then indexLevel()
+void finishLevel (Level& level);
+
+// A width x height floor with about 8% of it holes, start and goal in opposite corners. The
+// same seed gives the same level, so benchmarks on it are comparable between runs.
+Level generateLevel (int width, int height, unsigned seed);
+
+// Build specialAt from the switch groups and teleporters, so a tile's own entry is one lookup
+void indexLevel (Level& level);
+
+// The graph of every state reachable from level's start, respawns included - empty if the
+// level is too big to compile. Reads nothing but levels[level]'s tiles and side tables, and
+// never its graph, so it can run on another thread while the game plays.
+LevelGraph buildLevelGraph (const std::vector<Level>& levels, int level);
+
+// levels[level].graph = buildLevelGraph(levels, level)
+void compileLevel (std::vector<Level>& levels, int level);
+
+// Put a state on its level's graph if that was installed after the state entered the level
+void attachGraph (GameState& state);
+
+GameState newGame (const std::vector<Level>& levels, int lives = 3);
+
+// Replace the grid with a fresh copy of level index and put the block on its start tile
+void loadLevel (GameState& state, int level);
+
+// Flip every bridge cell of switch group j between empty and bridge in the live grid, and its toggled bit
+void toggleBridges (GameState& state, const std::vector<SwitchGroup>& switches, int j);
+
+/* Switch group the block's cell (x,y) presses as it rests, -1 if none. After a step that
+   reported EV_SWITCH these are the groups whose bridges it toggled. */
+int pressedSwitch (const GameState& state, int x, int y);
+
+// Roll the block one cell and apply the tile rules. Returns StepEvent flags, 0 if the move was ignored.
+int step (GameState& state, Move move);
+
+// After a fall: lose a life and restart the current level position. Sets GAME_OVER past the last life.
+void respawn (GameState& state);
+
+// Tile at (x,y) of the live grid, TILE_EMPTY outside it
+inline int tileAt (const GameState& state, int x, int y)
+{
+    if((unsigned)x >= (unsigned)state.width || (unsigned)y >= (unsigned)state.height)
+      return TILE_EMPTY;
+    return state.tiles[y * state.width + x];
+}
+
+#endif
@@ -0,0 +1,492 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <sstream>
+#include <string>
+
+#include "LevelFile.h"
+#include "Reach.h"
+
+using namespace std;
+
+static const char packMagic[8] = "BLXLVL2";
+
+// Largest grid either format accepts
+#define MAX_LEVEL_SIDE 4096
+
+static bool readFile (const char* path, string& data)
+{
+    FILE* f = fopen(path, "rb");
+    if(!f)
+      return false;
+    char buf[65536];
+    size_t n;
+    while((n = fread(buf, 1, sizeof(buf), f)) > 0)
+      data.append(buf, n);
+    fclose(f);
+    return true;
+}
+
+static int tileFromChar (char c)
+{
+    switch(c)
+    {
+    case '.': case ' ': return TILE_EMPTY;
+    case '#': return TILE_FLOOR;
+    case 'F': return TILE_FRAGILE;
+    case 'S': return TILE_SWITCH;
+    case 'T': return TILE_TELEPORT;
+    case 'G': return TILE_GOAL;
+    case 'H': return TILE_HEAVY_SWITCH;
+    case 'B': return TILE_BRIDGE;
+    default:  return -1;
+    }
+}
+
+static bool inside (const Level& level, int x, int y)
+{
+    return x >= 0 && x < level.width && y >= 0 && y < level.height;
+}
+
+// Checks shared by both formats, and the goal and fragile cells taken from the grid
+static bool checkLevel (const char* path, Level& level)
+{
+    int goals = 0;
+    for(int y = 0; y < level.height; y++)
+      for(int x = 0; x < level.width; x++)
+        if(levelTile(level, x, y) == TILE_GOAL)
+        {
+          level.goalX = x;
+          level.goalY = y;
+          goals++;
+        }
+    const char* error = NULL;
+    if(goals != 1)
+      error = "needs exactly one goal tile";
+    else if(!inside(level, level.startX, level.startY) || levelTile(level, level.startX, level.startY) == TILE_EMPTY)
+      error = "start is not on a tile";
+    // Each switch and teleporter end has a cell of its own, for Level::specialAt
+    vector<char> taken;
+    if(!error)
+      taken.assign(level.width * level.height, 0);
+    for(int j = 0; j < (int)level.teleporters.size() && !error; j++)
+    {
+      const Teleporter& t = level.teleporters[j];
+      if(!inside(level, t.ax, t.ay) || !inside(level, t.bx, t.by)
+         || levelTile(level, t.ax, t.ay) != TILE_TELEPORT || levelTile(level, t.bx, t.by) != TILE_TELEPORT)
+        error = "teleporter end is not a T tile";
+      else if(taken[t.ay * level.width + t.ax]++ || taken[t.by * level.width + t.bx]++)
+        error = "two teleporters share a tile";
+    }
+    for(int j = 0; j < (int)level.switches.size() && !error; j++)
+    {
+      const SwitchGroup& sw = level.switches[j];
+      int type = inside(level, sw.x, sw.y) ? levelTile(level, sw.x, sw.y) : TILE_EMPTY;
+      if(type != TILE_SWITCH && type != TILE_HEAVY_SWITCH)
+        error = "switch is not on an S or H tile";
+      else if(taken[sw.y * level.width + sw.x]++)
+        error = "two switch groups share a switch";
+      for(int k = 0; k < (int)sw.bridgeX.size() && !error; k++)
+        if(!inside(level, sw.bridgeX[k], sw.bridgeY[k]))
+          error = "bridge cell outside the grid";
+        else if(levelTile(level, sw.bridgeX[k], sw.bridgeY[k]) != TILE_EMPTY
+                && levelTile(level, sw.bridgeX[k], sw.bridgeY[k]) != TILE_BRIDGE)
+          error = "bridge cell is not a . or B tile";
+    }
+    // Over-approximates what the player can reach, so this only rejects levels no one can finish
+    if(!error && reachBitboard(level).goalMoves < 0)
+      error = "goal can't be reached from the start";
+    if(error)
+    {
+      fprintf(stderr, "%s: %s %s\n", path, level.name.c_str(), error);
+      return false;
+    }
+    finishLevel(level);
+    return true;
+}
+
+bool readLevelText (const char* path, Level& level)
+{
+    string data;
+    if(!readFile(path, data))
+    {
+      fprintf(stderr, "Levels: cannot read %s\n", path);
+      return false;
+    }
+
+    level = Level();
+    level.packCells = NULL;
+    level.width = level.height = 0;
+    level.startX = level.startY = -1;
+    istringstream in(data);
+    string line;
+    int lineNo = 0;
+    bool grid = false;
+    int rows = 0;
+    while(getline(in, line))
+    {
+      lineNo++;
+      if(!line.empty() && line[line.size() - 1] == '\r')
+        line.erase(line.size() - 1);
+
+      if(grid)
+      {
+        // Short rows are padded with empty tiles
+        if((int)line.size() > level.width)
+        {
+          fprintf(stderr, "%s:%d: grid row is wider than %d\n", path, lineNo, level.width);
+          return false;
+        }
+        for(int x = 0; x < (int)line.size(); x++)
+        {
+          int type = tileFromChar(line[x]);
+          if(type < 0)
+          {
+            fprintf(stderr, "%s:%d: unknown tile '%c'\n", path, lineNo, line[x]);
+            return false;
+          }
+          level.cells[rows * level.width + x] = type;
+        }
+        if(++rows == level.height)
+          grid = false;
+        continue;
+      }
+
+      istringstream words(line);
+      string key;
+      if(!(words >> key) || key[0] == '#')
+        continue;
+      bool ok = true;
+      if(key == "name")
+      {
+        getline(words >> ws, level.name);
+      }
+      else if(key == "size")
+      {
+        // Not once the grid has been sized by it
+        ok = level.cells.empty() && (words >> level.width >> level.height) && level.width > 0 && level.height > 0
+             && level.width <= MAX_LEVEL_SIDE && level.height <= MAX_LEVEL_SIDE;
+      }
+      else if(key == "start")
+      {
+        ok = (bool)(words >> level.startX >> level.startY);
+      }
+      else if(key == "teleport")
+      {
+        Teleporter t;
+        ok = (bool)(words >> t.ax >> t.ay >> t.bx >> t.by);
+        level.teleporters.push_back(t);
+      }
+      else if(key == "switch")
+      {
+        SwitchGroup sw;
+        string bridge;
+        ok = (words >> sw.x >> sw.y >> bridge) && bridge == "bridge";
+        int x, y;
+        while(ok && words >> x >> y)
+        {
+          sw.bridgeX.push_back(x);
+          sw.bridgeY.push_back(y);
+        }
+        ok = ok && !sw.bridgeX.empty();
+        level.switches.push_back(sw);
+      }
+      else if(key == "grid")
+      {
+        ok = level.width > 0 && level.cells.empty();
+        level.cells.assign(level.width * level.height, TILE_EMPTY);
+        grid = true;
+      }
+      else
+        ok = false;
+      if(!ok)
+      {
+        fprintf(stderr, "%s:%d: cannot parse '%s'\n", path, lineNo, line.c_str());
+        return false;
+      }
+    }
+    if(level.cells.empty() || rows != level.height || (int)level.cells.size() != level.width * level.height)
+    {
+      fprintf(stderr, "%s: expected %d grid rows\n", path, level.height);
+      return false;
+    }
+    return checkLevel(path, level);
+}
+
+template <typename T> static void put (string& out, T value)
+{
+    out.append((const char*)&value, sizeof(value));
+}
+
+bool writeLevelPack (const char* path, const vector<Level>& levels)
+{
+    string out;
+    PackHeader header;
+    memcpy(header.magic, packMagic, sizeof(header.magic));
+    header.count = levels.size();
+    header.reserved = 0;
+    put(out, header);
+    vector<PackIndexEntry> index(levels.size());
+    out.append(levels.size() * sizeof(PackIndexEntry), '\0');
+
+    for(int l = 0; l < (int)levels.size(); l++)
+    {
+      const Level& level = levels[l];
+      // Records start 8-byte aligned
+      out.append((8 - out.size() % 8) % 8, '\0');
+      size_t start = out.size();
+
+      string tables;
+      tables.append(level.name);
+      for(int j = 0; j < (int)level.teleporters.size(); j++)
+      {
+        const Teleporter& t = level.teleporters[j];
+        put<int16_t>(tables, t.ax);
+        put<int16_t>(tables, t.ay);
+        put<int16_t>(tables, t.bx);
+        put<int16_t>(tables, t.by);
+      }
+      for(int j = 0; j < (int)level.switches.size(); j++)
+      {
+        const SwitchGroup& sw = level.switches[j];
+        put<int16_t>(tables, sw.x);
+        put<int16_t>(tables, sw.y);
+        put<uint16_t>(tables, sw.bridgeX.size());
+        for(int k = 0; k < (int)sw.bridgeX.size(); k++)
+        {
+          put<int16_t>(tables, sw.bridgeX[k]);
+          put<int16_t>(tables, sw.bridgeY[k]);
+        }
+      }
+      for(int k = 0; k < (int)level.fragX.size(); k++)
+      {
+        put<int16_t>(tables, level.fragX[k]);
+        put<int16_t>(tables, level.fragY[k]);
+      }
+
+      LevelRecord rec;
+      rec.nameLength = level.name.size();
+      rec.width = level.width;
+      rec.height = level.height;
+      rec.startX = level.startX;
+      rec.startY = level.startY;
+      rec.goalX = level.goalX;
+      rec.goalY = level.goalY;
+      rec.numTeleporters = level.teleporters.size();
+      rec.numSwitches = level.switches.size();
+      rec.numFragile = level.fragX.size();
+      rec.cellOffset = sizeof(LevelRecord) + tables.size();
+      put(out, rec);
+      out.append(tables);
+      out.append((const char*)levelCells(level), level.width * level.height);
+
+      index[l].offset = start;
+      index[l].size = out.size() - start;
+      index[l].reserved = 0;
+    }
+    if(!index.empty())
+      memcpy(&out[sizeof(PackHeader)], &index[0], index.size() * sizeof(PackIndexEntry));
+
+    FILE* f = fopen(path, "wb");
+    if(!f || fwrite(out.data(), 1, out.size(), f) != out.size())
+    {
+      fprintf(stderr, "Levels: cannot write %s\n", path);
+      if(f)
+        fclose(f);
+      return false;
+    }
+    fclose(f);
+    return true;
+}
+
+static void clearPack (LevelPack& pack)
+{
+    pack.data = NULL;
+    pack.size = 0;
+    pack.count = 0;
+    pack.index = NULL;
+}
+
+bool openLevelPack (const char* path, LevelPack& pack)
+{
+    clearPack(pack);
+
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+    {
+      fprintf(stderr, "Levels: cannot read %s\n", path);
+      return false;
+    }
+    struct stat st;
+    void* map = MAP_FAILED;
+    if(fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(PackHeader))
+      map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+    {
+      fprintf(stderr, "Levels: %s is not a level pack\n", path);
+      return false;
+    }
+
+    const PackHeader* header = (const PackHeader*)map;
+    if(memcmp(header->magic, packMagic, sizeof(header->magic)) != 0
+       || header->count > (st.st_size - sizeof(PackHeader)) / sizeof(PackIndexEntry))
+    {
+      fprintf(stderr, "Levels: %s is not a level pack\n", path);
+      munmap(map, st.st_size);
+      return false;
+    }
+    pack.data = (const char*)map;
+    pack.size = st.st_size;
+    pack.count = header->count;
+    pack.index = (const PackIndexEntry*)(pack.data + sizeof(PackHeader));
+    return true;
+}
+
+void closeLevelPack (LevelPack& pack)
+{
+    if(pack.data)
+      munmap((void*)pack.data, pack.size);
+    clearPack(pack);
+}
+
+// Bounds-checked reads from a level record
+struct RecordReader {
+    const char* p;
+    const char* end;
+
+    template <typename T> bool get (T& value)
+    {
+      if(end - p < (ptrdiff_t)sizeof(T))
+        return false;
+      memcpy(&value, p, sizeof(T));
+      p += sizeof(T);
+      return true;
+    }
+    bool get16 (int& value)
+    {
+      int16_t v;
+      if(!get(v))
+        return false;
+      value = v;
+      return true;
+    }
+};
+
+bool readPackLevel (const LevelPack& pack, int i, Level& level)
+{
+    level = Level();
+    level.packCells = NULL;
+    const PackIndexEntry& entry = pack.index[i];
+    if(entry.offset > pack.size || entry.size > pack.size - entry.offset)
+    {
+      fprintf(stderr, "Levels: pack level %d lies outside the file\n", i + 1);
+      return false;
+    }
+    RecordReader in;
+    in.p = pack.data + entry.offset;
+    in.end = in.p + entry.size;
+
+    LevelRecord rec;
+    bool ok = in.get(rec) && rec.width > 0 && rec.height > 0
+              && rec.width <= MAX_LEVEL_SIDE && rec.height <= MAX_LEVEL_SIDE
+              && rec.cellOffset <= entry.size
+              && entry.size - rec.cellOffset >= (uint32_t)rec.width * rec.height
+              && in.end - in.p >= rec.nameLength;
+    if(ok)
+    {
+      level.name.assign(in.p, rec.nameLength);
+      in.p += rec.nameLength;
+      level.width = rec.width;
+      level.height = rec.height;
+      level.startX = rec.startX;
+      level.startY = rec.startY;
+      level.goalX = rec.goalX;
+      level.goalY = rec.goalY;
+      level.teleporters.resize(rec.numTeleporters);
+      level.switches.resize(rec.numSwitches);
+      level.fragX.resize(rec.numFragile);
+      level.fragY.resize(rec.numFragile);
+      level.packCells = (const unsigned char*)pack.data + entry.offset + rec.cellOffset;
+      ok = inside(level, level.startX, level.startY) && inside(level, level.goalX, level.goalY);
+    }
+    for(int j = 0; ok && j < rec.numTeleporters; j++)
+    {
+      Teleporter& t = level.teleporters[j];
+      ok = in.get16(t.ax) && in.get16(t.ay) && in.get16(t.bx) && in.get16(t.by)
+           && inside(level, t.ax, t.ay) && inside(level, t.bx, t.by);
+    }
+    for(int j = 0; ok && j < rec.numSwitches; j++)
+    {
+      SwitchGroup& sw = level.switches[j];
+      uint16_t numBridges = 0;
+      ok = in.get16(sw.x) && in.get16(sw.y) && in.get(numBridges) && inside(level, sw.x, sw.y);
+      sw.bridgeX.resize(numBridges);
+      sw.bridgeY.resize(numBridges);
+      for(int k = 0; ok && k < numBridges; k++)
+        ok = in.get16(sw.bridgeX[k]) && in.get16(sw.bridgeY[k]) && inside(level, sw.bridgeX[k], sw.bridgeY[k]);
+    }
+    for(int k = 0; ok && k < rec.numFragile; k++)
+      ok = in.get16(level.fragX[k]) && in.get16(level.fragY[k]) && inside(level, level.fragX[k], level.fragY[k]);
+    if(!ok)
+    {
+      fprintf(stderr, "Levels: pack level %d is corrupt\n", i + 1);
+      return false;
+    }
+    indexLevel(level);
+    return true;
+}
+
+bool checkLevelTiles (const Level& level)
+{
+    const unsigned char* cells = levelCells(level);
+    const char* error = NULL;
+    for(int c = 0; c < level.width * level.height && !error; c++)
+      if(cells[c] >= NUM_TILE_TYPES || (cells[c] == TILE_GOAL) != (c == level.goalY * level.width + level.goalX))
+        error = cells[c] >= NUM_TILE_TYPES ? "has an unknown tile type" : "goal does not match its tile";
+    for(int j = 0; j < (int)level.teleporters.size() && !error; j++)
+    {
+      const Teleporter& t = level.teleporters[j];
+      if(levelTile(level, t.ax, t.ay) != TILE_TELEPORT || levelTile(level, t.bx, t.by) != TILE_TELEPORT)
+        error = "teleporter end is not a T tile";
+    }
+    for(int j = 0; j < (int)level.switches.size() && !error; j++)
+    {
+      int type = levelTile(level, level.switches[j].x, level.switches[j].y);
+      if(type != TILE_SWITCH && type != TILE_HEAVY_SWITCH)
+        error = "switch is not on an S or H tile";
+    }
+    for(int k = 0; k < (int)level.fragX.size() && !error; k++)
+      if(levelTile(level, level.fragX[k], level.fragY[k]) != TILE_FRAGILE)
+        error = "fragile cell is not an F tile";
+    if(error)
+    {
+      fprintf(stderr, "Levels: %s %s\n", level.name.c_str(), error);
+      return false;
+    }
+    return true;
+}
+
+bool loadLevels (const char* path, vector<Level>& levels, LevelPack& pack)
+{
+    clearPack(pack);
+    size_t n = strlen(path);
+    if(n > 4 && strcmp(path + n - 4, ".txt") == 0)
+    {
+      Level level;
+      if(!readLevelText(path, level))
+        return false;
+      levels.push_back(level);
+      return true;
+    }
+    if(!openLevelPack(path, pack))
+      return false;
+    levels.resize(levels.size() + pack.count);
+    for(int i = 0; i < pack.count; i++)
+      if(!readPackLevel(pack, i, levels[levels.size() - pack.count + i]))
+        return false;
+    return true;
+}
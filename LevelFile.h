@@ -0,0 +1,84 @@
+#ifndef LEVELFILE_H
+#define LEVELFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "Game.h"
+
+/* Levels on disk - text files for writing them, one binary pack for shipping them.
+
+   Text (levels/NAME.txt), one directive per line, # starts a comment:
+     name <rest of the line>
+     size <width> <height>
+     start <x> <y>
+     teleport <ax> <ay> <bx> <by>             any number of pairs, both ends T tiles
+     switch <x> <y> bridge <x> <y> [<x> <y>...]   any number of groups, the switch an S tile
+     grid                                     followed by <height> rows of <width> tiles:
+       .  empty      #  floor      F  fragile
+       S  soft switch               H  heavy switch
+       T  teleporter G  goal (exactly one)    B  bridge
+   Row 0 is the first grid line, x counts from the left. A bridge cell's grid tile is its
+   state when the level starts, B or . for one that a switch puts in later. No two switch
+   groups or teleporter ends share a cell, and reachBitboard() must find a way to the goal.
+
+   Pack (.blxp), written by tools/levelpack in host byte order: a PackHeader, an index of one
+   PackIndexEntry per level, then each level's record at its offset - a LevelRecord, the name,
+   the teleporters, switch groups and fragile cells as int16s, and at cellOffset the
+   width*height tile bytes, row-major. The pack is mapped rather than read: opening it touches
+   the index and the small side tables only, and a level's tile bytes are used in place, so
+   they are paged in when that level is first played or drawn. levelpack validated the tiles,
+   the reader only bounds-checks the records. */
+
+struct PackHeader {
+    char magic[8];          // "BLXLVL2"
+    uint32_t count;
+    uint32_t reserved;
+};
+
+struct PackIndexEntry {
+    uint64_t offset;        // from the start of the file
+    uint32_t size;          // record bytes, tiles included
+    uint32_t reserved;
+};
+
+struct LevelRecord {
+    uint16_t nameLength;
+    int16_t width, height;
+    int16_t startX, startY;
+    int16_t goalX, goalY;
+    uint16_t numTeleporters;
+    uint16_t numSwitches;
+    uint16_t numFragile;
+    uint32_t cellOffset;    // from the start of the record
+};
+
+// A mapped pack. Levels read from it point into the mapping, so it stays open while they are used.
+struct LevelPack {
+    const char* data;
+    size_t size;
+    int count;
+    const PackIndexEntry* index;
+};
+
+// Read one text level, false with a message on stderr if it is malformed
+bool readLevelText (const char* path, Level& level);
+
+bool writeLevelPack (const char* path, const std::vector<Level>& levels);
+
+bool openLevelPack (const char* path, LevelPack& pack);
+void closeLevelPack (LevelPack& pack);
+
+// Level i of an open pack, its tiles left in the mapping
+bool readPackLevel (const LevelPack& pack, int i, Level& level);
+
+// The checks readPackLevel() skips because they read the tiles: every byte a TileType, the
+// goal, switches and teleporters on tiles of their type. Takes the level const, so it can run
+// on the streaming thread. False with a message on stderr.
+bool checkLevelTiles (const Level& level);
+
+// Append the levels of a pack, opened into pack, or the single text level when path ends in .txt
+bool loadLevels (const char* path, std::vector<Level>& levels, LevelPack& pack);
+
+#endif
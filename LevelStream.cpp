@@ -0,0 +1,122 @@
+#include <stdlib.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "LevelFile.h"
+#include "LevelStream.h"
+#include "Trace.h"
+
+using namespace std;
+
+static const vector<Level>* streamLevels = NULL;
+static thread* worker = NULL;
+static mutex streamLock;
+static condition_variable wake;             // the worker waits on it for requests
+static deque<int> requests;
+static vector<char> requested;
+static vector<PreparedLevel*> prepared;     // by level, NULL until the worker is done with it
+static bool stopping = false;
+
+static void prepare (PreparedLevel& p)
+{
+    TRACE_SCOPE("prepare level");
+    const Level& lvl = (*streamLevels)[p.level];
+    {
+      TRACE_SCOPE("checkLevelTiles");
+      // Reading every tile byte here is what pages a mapped level in, off the render thread
+      p.valid = checkLevelTiles(lvl);
+    }
+    if(!p.valid)
+      return;
+    {
+      TRACE_SCOPE("buildLevelGraph");
+      p.graph = buildLevelGraph(*streamLevels, p.level);
+    }
+
+    TRACE_SCOPE("list tiles");
+    const unsigned char* cells = levelCells(lvl);
+    int numCells = lvl.width * lvl.height;
+    p.slot.assign(numCells, -1);
+    for(int c = 0; c < numCells; c++)
+      if(cells[c] != TILE_EMPTY)
+      {
+        p.slot[c] = p.tileCells.size();
+        p.tileCells.push_back(c);
+      }
+}
+
+static void workerLoop ()
+{
+    traceThreadName("level stream");
+    unique_lock<mutex> guard(streamLock);
+    for(;;)
+    {
+      wake.wait(guard, [] { return stopping || !requests.empty(); });
+      if(stopping)
+        return;
+      PreparedLevel* p = new PreparedLevel();
+      p->level = requests.front();
+      requests.pop_front();
+
+      guard.unlock();
+      prepare(*p);
+      guard.lock();
+      prepared[p->level] = p;
+    }
+}
+
+void levelStreamStart (const vector<Level>& levels)
+{
+    levelStreamStop();
+    streamLevels = &levels;
+    requested.assign(levels.size(), 0);
+    prepared.assign(levels.size(), NULL);
+    stopping = false;
+    worker = new thread(workerLoop);
+    // exit() is called from several places in the game - make sure the worker is joined first
+    static bool registered = false;
+    if(!registered)
+    {
+      atexit(levelStreamStop);
+      registered = true;
+    }
+}
+
+void levelStreamStop ()
+{
+    if(!worker)
+      return;
+    {
+      lock_guard<mutex> guard(streamLock);
+      stopping = true;
+      requests.clear();
+    }
+    wake.notify_all();
+    worker->join();
+    delete worker;
+    worker = NULL;
+    for(int l = 0; l < (int)prepared.size(); l++)
+      delete prepared[l];
+    prepared.clear();
+    requested.clear();
+}
+
+void levelStreamRequest (int level)
+{
+    {
+      lock_guard<mutex> guard(streamLock);
+      if(!worker || level < 0 || level >= (int)requested.size() || requested[level])
+        return;
+      requested[level] = 1;
+      requests.push_back(level);
+    }
+    wake.notify_all();
+}
+
+PreparedLevel* levelStreamPoll (int level)
+{
+    lock_guard<mutex> guard(streamLock);
+    return level >= 0 && level < (int)prepared.size() ? prepared[level] : NULL;
+}
@@ -0,0 +1,34 @@
+#ifndef LEVELSTREAM_H
+#define LEVELSTREAM_H
+
+#include <vector>
+
+#include "Game.h"
+
+/* Level streaming - while one level is played the next is made ready on a worker thread:
+   its tile bytes paged in from the pack and checked, its graph compiled and its tiles listed
+   for the renderer, which then uploads them a slice per frame. The worker only reads the
+   levels; installing a graph into its Level is left to the main thread, which can do it at
+   any time because buildLevelGraph() never reads one. */
+
+struct PreparedLevel {
+    int level;
+    bool valid;                     // false if checkLevelTiles() failed, the reason is on stderr
+    LevelGraph graph;               // moved out by whoever installs it
+    std::vector<int> tileCells;     // y*width + x of every non-empty tile, row-major - the instance order
+    std::vector<int> slot;          // cell -> index into tileCells, -1 for empty cells
+};
+
+// Start the worker on levels, which must not be resized until levelStreamStop()
+void levelStreamStart (const std::vector<Level>& levels);
+
+// Join the worker, dropping whatever it had queued. Safe to call twice.
+void levelStreamStop ();
+
+// Queue level for preparing after any earlier requests. Repeats and levels out of range are ignored.
+void levelStreamRequest (int level);
+
+// The finished preparation of level, or NULL while it is queued or being worked on. Never blocks.
+PreparedLevel* levelStreamPoll (int level);
+
+#endif
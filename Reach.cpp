@@ -0,0 +1,498 @@
+#include <algorithm>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include "Reach.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define REACH_X86 1
+#endif
+
+using namespace std;
+
+/* The grid, padded by one cell all round so a block half hanging off the edge still has a
+   bit, is cut into strips 64 columns wide with one word per row of a strip, and the strips
+   are stored one after another: cell (x,y) is bit (x+1) % 64 of word (x+1) / 64 * stride + y+1.
+   Each strip's words end in at least 2 empty rows, so moving a row is moving a whole word
+   and never reaches the next strip. Moving a column is a shift by 1 or 2, carrying the bits
+   that cross into the strip either side from stride words away. A lying block is stored at
+   its lower cell:
+     standing <- lyingX >> 1 | lyingX << 2 | lyingY[y-2] | lyingY[y+1]
+     lyingX   <- standing >> 2 | standing << 1 | lyingX[y-1] | lyingX[y+1]
+     lyingY   <- standing[y-1] | standing[y+2] | lyingY >> 1 | lyingY << 1
+   and each result is masked by where that orientation can rest and hasn't been reached yet.
+
+   A BFS wavefront across a big level is a thin line through every row it spans, a word or
+   two of each. Within one strip it is a short run of rows, so each layer sweeps only the rows
+   around each strip's part of it - see Span. */
+
+enum { ORIENT_S, ORIENT_LX, ORIENT_LY, NUM_ORIENT };
+
+struct Board {
+    vector<uint64_t> buf;
+    uint64_t* w;        // nwords words, with guard words either side so shifted loads never leave buf
+
+    void init (int nwords, int guard)
+    {
+      buf.assign(nwords + 2*guard + 8, 0);
+      w = &buf[guard];
+      w += (64 - ((uintptr_t)w & 63)) / 8 % 8;    // cache line aligned, so fewer loads split lines
+    }
+    void set (int b) { w[b >> 6] |= (uint64_t)1 << (b & 63); }
+    bool test (int b) const { return (w[b >> 6] >> (b & 63)) & 1; }
+
+private:
+    void operator= (const Board&);
+};
+
+struct Grid {
+    int strips;                         // 64 column strips across the padded grid
+    int stride;                         // words per strip, whole AVX2 vectors
+    int nbits, nwords, guard;
+    int start, goal;
+    Board floor, frag;
+    Board valid[NUM_ORIENT];
+    vector<int> teleA, teleB;           // bits of each teleporter's two ends
+};
+
+// Words [lo,hi) of one strip the next layer has to sweep - where the frontier has bits, and
+// the rows the strips either side carry into it. Empty when lo >= hi.
+struct Span {
+    int lo, hi;
+};
+
+static const Span noSpan = {INT_MAX, INT_MIN};
+
+static inline void widen (Span& s, int lo, int hi)
+{
+    s.lo = min(s.lo, lo);
+    s.hi = max(s.hi, hi);
+}
+
+static inline int cellBit (const Grid& g, int x, int y)
+{
+    return ((x + 1) / 64 * g.stride + y + 1) * 64 + (x + 1) % 64;
+}
+
+// Word i of src moved d columns towards higher bits, lower if d < 0, with the bits that cross
+// from the strip either side
+static inline uint64_t across (const uint64_t* src, int i, int d, int stride)
+{
+    if(d > 0)
+      return (src[i] << d) | (src[i - stride] >> (64 - d));
+    return (src[i] >> -d) | (src[i + stride] << (64 + d));
+}
+
+// Sets the floor and fragile bits of row y's n cells
+static void gridRow (Grid& g, int y, const unsigned char* cells, int n)
+{
+    int x = 0;
+#if defined(REACH_X86) && defined(__SSE2__)
+    // 16 cells a compare, each mask landing in one strip or across two
+    for(; x + 16 <= n; x += 16)
+    {
+      __m128i c = _mm_loadu_si128((const __m128i*)(cells + x));
+      uint64_t solid = ~_mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8(TILE_EMPTY))) & 0xFFFF;
+      uint64_t frag = _mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8(TILE_FRAGILE)));
+      int i = cellBit(g, x, y) >> 6, r = (x + 1) % 64;
+      g.floor.w[i] |= solid << r;
+      g.frag.w[i] |= frag << r;
+      if(r > 48)
+      {
+        g.floor.w[i + g.stride] |= solid >> (64 - r);
+        g.frag.w[i + g.stride] |= frag >> (64 - r);
+      }
+    }
+#endif
+    for(; x < n; x++)
+      if(cells[x] != TILE_EMPTY)
+      {
+        g.floor.set(cellBit(g, x, y));
+        if(cells[x] == TILE_FRAGILE)
+          g.frag.set(cellBit(g, x, y));
+      }
+}
+
+static void buildGrid (Grid& g, const Level& level)
+{
+    g.strips = (level.width + 2 + 63) / 64;
+    g.stride = (level.height + 2 + 2 + 3) & ~3;
+    g.nwords = g.strips * g.stride;
+    g.nbits = g.nwords * 64;
+    g.guard = g.stride + 8;
+    g.start = cellBit(g, level.startX, level.startY);
+    g.goal = cellBit(g, level.goalX, level.goalY);
+
+    g.floor.init(g.nwords, g.guard);
+    g.frag.init(g.nwords, g.guard);
+    for(int k = 0; k < NUM_ORIENT; k++)
+      g.valid[k].init(g.nwords, g.guard);
+    const unsigned char* cells = levelCells(level);
+    for(int y = 0; y < level.height; y++)
+      gridRow(g, y, cells + y * level.width, level.width);
+    // Bridges as if every one were in, whether or not the switches can put them there together
+    for(int j = 0; j < (int)level.switches.size(); j++)
+    {
+      const SwitchGroup& sw = level.switches[j];
+      for(int k = 0; k < (int)sw.bridgeX.size(); k++)
+        g.floor.set(cellBit(g, sw.bridgeX[k], sw.bridgeY[k]));
+    }
+    for(int j = 0; j < (int)level.teleporters.size(); j++)
+    {
+      const Teleporter& t = level.teleporters[j];
+      g.teleA.push_back(cellBit(g, t.ax, t.ay));
+      g.teleB.push_back(cellBit(g, t.bx, t.by));
+    }
+    // Standing needs a solid tile, lying needs a tile under either half
+    const uint64_t *F = g.floor.w;
+    for(int i = 0; i < g.nwords; i++)
+    {
+      g.valid[ORIENT_S].w[i] = F[i] & ~g.frag.w[i];
+      g.valid[ORIENT_LX].w[i] = F[i] | across(F, i, -1, g.stride);
+      g.valid[ORIENT_LY].w[i] = F[i] | F[i + 1];
+    }
+}
+
+// Bits 0-1 of a strip move into the strip before it, bits 62-63 into the one after
+#define EDGE_LOW 3ull
+#define EDGE_HIGH (3ull << 62)
+
+// One BFS layer over words [lo,hi) of strip c, whole vectors: writes the new frontier to next
+// and takes it out of open, the resting places not reached yet. Widens spans to cover the
+// words it reached in each strip. Returns false if nothing new was reached.
+static bool layerScalar (const Grid& g, uint64_t* const cur[NUM_ORIENT], uint64_t* const next[NUM_ORIENT],
+                         uint64_t* const open[NUM_ORIENT], int c, int lo, int hi, Span* spans)
+{
+    const uint64_t *S = cur[ORIENT_S], *LX = cur[ORIENT_LX], *LY = cur[ORIENT_LY];
+    const int stride = g.stride;
+    bool found = false;
+    for(int i = lo; i < hi; i++)
+    {
+      uint64_t s = across(LX, i, -1, stride) | across(LX, i, 2, stride) | LY[i - 2] | LY[i + 1];
+      uint64_t lx = across(S, i, -2, stride) | across(S, i, 1, stride) | LX[i - 1] | LX[i + 1];
+      uint64_t ly = S[i - 1] | S[i + 2] | across(LY, i, -1, stride) | across(LY, i, 1, stride);
+      s &= open[ORIENT_S][i];
+      lx &= open[ORIENT_LX][i];
+      ly &= open[ORIENT_LY][i];
+      next[ORIENT_S][i] = s;
+      next[ORIENT_LX][i] = lx;
+      next[ORIENT_LY][i] = ly;
+      uint64_t any = s | lx | ly;
+      if(any)
+      {
+        open[ORIENT_S][i] ^= s;
+        open[ORIENT_LX][i] ^= lx;
+        open[ORIENT_LY][i] ^= ly;
+        widen(spans[c], i, i + 1);
+        if(c > 0 && (any & EDGE_LOW))
+          widen(spans[c - 1], i - stride, i - stride + 1);
+        if(c + 1 < g.strips && (any & EDGE_HIGH))
+          widen(spans[c + 1], i + stride, i + stride + 1);
+        found = true;
+      }
+    }
+    return found;
+}
+
+#ifdef REACH_X86
+__attribute__((target("avx2")))
+static inline __m256i load4 (const uint64_t* src, int i)
+{
+    return _mm256_loadu_si256((const __m256i*)(src + i));
+}
+
+__attribute__((target("avx2")))
+static inline void store4 (uint64_t* dst, int i, __m256i v)
+{
+    _mm256_storeu_si256((__m256i*)(dst + i), v);
+}
+
+// across() for words i..i+3. The four column moves are constants, so these are immediate
+// shifts - one instruction each rather than the two a shift by a register takes.
+template <int d> __attribute__((target("avx2")))
+static inline __m256i across4 (const uint64_t* src, int i, int stride)
+{
+    if(d > 0)
+      return _mm256_or_si256(_mm256_slli_epi64(load4(src, i), d), _mm256_srli_epi64(load4(src, i - stride), 64 - d));
+    return _mm256_or_si256(_mm256_srli_epi64(load4(src, i), -d), _mm256_slli_epi64(load4(src, i + stride), 64 + d));
+}
+
+__attribute__((target("avx2")))
+static bool layerAvx2 (const Grid& g, uint64_t* const cur[NUM_ORIENT], uint64_t* const next[NUM_ORIENT],
+                       uint64_t* const open[NUM_ORIENT], int c, int lo, int hi, Span* spans)
+{
+    // Locals, so the stores can't be taken to move them
+    const uint64_t *S = cur[ORIENT_S], *LX = cur[ORIENT_LX], *LY = cur[ORIENT_LY];
+    uint64_t *nextS = next[ORIENT_S], *nextLX = next[ORIENT_LX], *nextLY = next[ORIENT_LY];
+    uint64_t *openS = open[ORIENT_S], *openLX = open[ORIENT_LX], *openLY = open[ORIENT_LY];
+    const int stride = g.stride;
+    const __m256i edgeLow = _mm256_set1_epi64x(EDGE_LOW), edgeHigh = _mm256_set1_epi64x(EDGE_HIGH);
+    Span own = noSpan;
+    for(int i = lo; i < hi; i += 4)
+    {
+      __m256i s = _mm256_or_si256(
+          _mm256_or_si256(across4<-1>(LX, i, stride), across4<2>(LX, i, stride)),
+          _mm256_or_si256(load4(LY, i - 2), load4(LY, i + 1)));
+      __m256i lx = _mm256_or_si256(
+          _mm256_or_si256(across4<-2>(S, i, stride), across4<1>(S, i, stride)),
+          _mm256_or_si256(load4(LX, i - 1), load4(LX, i + 1)));
+      __m256i ly = _mm256_or_si256(
+          _mm256_or_si256(load4(S, i - 1), load4(S, i + 2)),
+          _mm256_or_si256(across4<-1>(LY, i, stride), across4<1>(LY, i, stride)));
+
+      __m256i oS = load4(openS, i), oLX = load4(openLX, i), oLY = load4(openLY, i);
+      s = _mm256_and_si256(s, oS);
+      lx = _mm256_and_si256(lx, oLX);
+      ly = _mm256_and_si256(ly, oLY);
+      store4(nextS, i, s);
+      store4(nextLX, i, lx);
+      store4(nextLY, i, ly);
+      __m256i any = _mm256_or_si256(s, _mm256_or_si256(lx, ly));
+      if(_mm256_testz_si256(any, any))
+        continue;
+      store4(openS, i, _mm256_xor_si256(oS, s));
+      store4(openLX, i, _mm256_xor_si256(oLX, lx));
+      store4(openLY, i, _mm256_xor_si256(oLY, ly));
+      widen(own, i, i + 4);
+      if(c > 0 && !_mm256_testz_si256(any, edgeLow))
+        widen(spans[c - 1], i - stride, i - stride + 4);
+      if(c + 1 < g.strips && !_mm256_testz_si256(any, edgeHigh))
+        widen(spans[c + 1], i + stride, i + stride + 4);
+    }
+    if(own.lo >= own.hi)
+      return false;
+    widen(spans[c], own.lo, own.hi);
+    return true;
+}
+
+static bool haveAvx2 ()
+{
+    static int avx2 = -1;
+    if(avx2 < 0)
+    {
+      __builtin_cpu_init();
+      avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+    return avx2 == 1;
+}
+#endif
+
+// Widens the span of bit b's strip, and of the strip either side if a column move takes b there
+static void spanBit (const Grid& g, Span* spans, int b)
+{
+    int i = b >> 6, c = i / g.stride;
+    uint64_t bit = (uint64_t)1 << (b & 63);
+    widen(spans[c], i, i + 1);
+    if(c > 0 && (bit & EDGE_LOW))
+      widen(spans[c - 1], i - g.stride, i - g.stride + 1);
+    if(c + 1 < g.strips && (bit & EDGE_HIGH))
+      widen(spans[c + 1], i + g.stride, i + g.stride + 1);
+}
+
+// Standing on one end of a teleporter reaches the other in the same move. Adds those to the
+// standing frontier until no more are found, widening spans to cover them.
+static void teleportFrontier (const Grid& g, uint64_t* frontier, uint64_t* open, Span* spans)
+{
+    bool more = !g.teleA.empty();
+    while(more)
+    {
+      more = false;
+      for(int j = 0; j < (int)g.teleA.size(); j++)
+        for(int end = 0; end < 2; end++)
+        {
+          int from = end ? g.teleB[j] : g.teleA[j], to = end ? g.teleA[j] : g.teleB[j];
+          uint64_t bit = (uint64_t)1 << (to & 63);
+          if(((frontier[from >> 6] >> (from & 63)) & 1) && (open[to >> 6] & bit))
+          {
+            frontier[to >> 6] |= bit;
+            open[to >> 6] ^= bit;
+            spanBit(g, spans, to);
+            more = true;
+          }
+        }
+    }
+}
+
+Reach reachBitboard (const Level& level)
+{
+    Grid g;
+    buildGrid(g, level);
+
+    // open starts as every resting place and loses each layer as it is reached
+    Board frontier[2][NUM_ORIENT], open[NUM_ORIENT];
+    uint64_t *cur[NUM_ORIENT], *next[NUM_ORIENT], *openW[NUM_ORIENT];
+    for(int k = 0; k < NUM_ORIENT; k++)
+    {
+      frontier[0][k].init(g.nwords, g.guard);
+      frontier[1][k].init(g.nwords, g.guard);
+      open[k].init(g.nwords, g.guard);
+      copy(g.valid[k].w - g.guard, g.valid[k].w + g.nwords + g.guard, open[k].w - g.guard);
+      cur[k] = frontier[0][k].w;
+      next[k] = frontier[1][k].w;
+      openW[k] = open[k].w;
+    }
+
+    bool (*layer)(const Grid&, uint64_t* const*, uint64_t* const*, uint64_t* const*, int, int, int, Span*) = layerScalar;
+#ifdef REACH_X86
+    if(haveAvx2())
+      layer = layerAvx2;
+#endif
+
+    // Per strip, the spans of the frontier, of the one being found and of the one before -
+    // whose bits are still in next's buffer
+    vector<Span> spanBuf[3];
+    for(int k = 0; k < 3; k++)
+      spanBuf[k].assign(g.strips, noSpan);
+    Span *curSpans = &spanBuf[0][0], *nextSpans = &spanBuf[1][0], *oldSpans = &spanBuf[2][0];
+
+    Reach res;
+    res.goalMoves = -1;
+    if(g.valid[ORIENT_S].test(g.start))
+    {
+      frontier[0][ORIENT_S].set(g.start);
+      openW[ORIENT_S][g.start >> 6] ^= (uint64_t)1 << (g.start & 63);
+      spanBit(g, curSpans, g.start);
+      teleportFrontier(g, cur[ORIENT_S], openW[ORIENT_S], curSpans);
+      for(int moves = 0; ; moves++)
+      {
+        if((cur[ORIENT_S][g.goal >> 6] >> (g.goal & 63)) & 1)
+        {
+          res.goalMoves = moves;
+          break;
+        }
+        bool found = false;
+        for(int c = 0; c < g.strips; c++)
+        {
+          // A row move reaches 2 rows either side
+          const Span& from = curSpans[c];
+          int lo = 0, hi = 0;
+          if(from.lo < from.hi)
+          {
+            lo = max(c * g.stride, from.lo - 2) & ~3;
+            hi = min((c + 1) * g.stride, (from.hi + 2 + 3) & ~3);
+          }
+          // The layer writes all of [lo,hi) of next, the rest of the old frontier there is cleared
+          const Span& old = oldSpans[c];
+          for(int k = 0; k < NUM_ORIENT && old.lo < old.hi; k++)
+          {
+            if(old.lo < lo)
+              memset(next[k] + old.lo, 0, (min(old.hi, lo) - old.lo) * sizeof(uint64_t));
+            if(old.hi > hi)
+              memset(next[k] + max(old.lo, hi), 0, (old.hi - max(old.lo, hi)) * sizeof(uint64_t));
+          }
+          if(lo < hi)
+            found |= layer(g, cur, next, openW, c, lo, hi, nextSpans);
+        }
+        if(!found)
+          break;
+        teleportFrontier(g, next[ORIENT_S], openW[ORIENT_S], nextSpans);
+        for(int k = 0; k < NUM_ORIENT; k++)
+          swap(cur[k], next[k]);
+        Span* spans = oldSpans;
+        oldSpans = curSpans;
+        curSpans = nextSpans;
+        nextSpans = spans;
+        fill(nextSpans, nextSpans + g.strips, noSpan);
+      }
+    }
+
+    res.states = 0;
+    for(int k = 0; k < NUM_ORIENT; k++)
+      for(int i = 0; i < g.nwords; i++)
+        res.states += __builtin_popcountll(g.valid[k].w[i] & ~openW[k][i]);
+    return res;
+}
+
+Reach reachBfs (const Level& level)
+{
+    Grid g;
+    buildGrid(g, level);
+
+    // Destination of each move, per orientation - the same table as the shifts above
+    const int moveTo[NUM_ORIENT][NUM_MOVES][3] = {
+      // {orientation, columns, rows} for left, right, up, down
+      {{ORIENT_LX, -2, 0}, {ORIENT_LX, 1, 0}, {ORIENT_LY, 0, 1}, {ORIENT_LY, 0, -2}},
+      {{ORIENT_S, -1, 0}, {ORIENT_S, 2, 0}, {ORIENT_LX, 0, 1}, {ORIENT_LX, 0, -1}},
+      {{ORIENT_LY, -1, 0}, {ORIENT_LY, 1, 0}, {ORIENT_S, 0, 2}, {ORIENT_S, 0, -1}},
+    };
+
+    Reach res;
+    res.goalMoves = -1;
+    res.states = 0;
+    if(!g.valid[ORIENT_S].test(g.start))
+      return res;
+
+    vector<char> seen(NUM_ORIENT * g.nbits, 0);
+    vector<int> queue;
+    queue.reserve(NUM_ORIENT * g.nbits);
+    queue.push_back(ORIENT_S * g.nbits + g.start);
+    seen[queue[0]] = 1;
+    // Standing on a teleporter end also reaches the other end, in the same layer
+    vector<int> teleTo;
+    for(int j = 0; j < (int)g.teleA.size(); j++)
+    {
+      teleTo.push_back(g.teleA[j]);
+      teleTo.push_back(g.teleB[j]);
+    }
+    for(size_t k = 0; k < queue.size(); k++)
+      for(int j = 0; j < (int)teleTo.size(); j++)
+        if(queue[k] == ORIENT_S * g.nbits + teleTo[j] && !seen[ORIENT_S * g.nbits + teleTo[j ^ 1]])
+        {
+          seen[ORIENT_S * g.nbits + teleTo[j ^ 1]] = 1;
+          queue.push_back(ORIENT_S * g.nbits + teleTo[j ^ 1]);
+        }
+
+    // Layer by layer, so states counts the whole layer the goal is found in, like the bitboards
+    size_t layerStart = 0;
+    for(int moves = 0; layerStart < queue.size(); moves++)
+    {
+      size_t layerEnd = queue.size();
+      bool goal = false;
+      for(size_t k = layerStart; k < layerEnd; k++)
+        if(queue[k] == ORIENT_S * g.nbits + g.goal)
+          goal = true;
+      if(goal)
+      {
+        res.goalMoves = moves;
+        break;
+      }
+      for(size_t k = layerStart; k < layerEnd; k++)
+      {
+        int o = queue[k] / g.nbits, b = queue[k] % g.nbits;
+        for(int m = 0; m < NUM_MOVES; m++)
+        {
+          // A row is a word, a column a bit - stride words on for the next strip
+          int no = moveTo[o][m][0], col = (b & 63) + moveTo[o][m][1];
+          int nb = b + moveTo[o][m][1] + 64 * moveTo[o][m][2];
+          if(col < 0)
+            nb -= 64 * (g.stride - 1);
+          else if(col > 63)
+            nb += 64 * (g.stride - 1);
+          if(nb < 0 || nb >= g.nbits || !g.valid[no].test(nb))
+            continue;
+          int id = no * g.nbits + nb;
+          if(seen[id])
+            continue;
+          seen[id] = 1;
+          queue.push_back(id);
+          // Chains of teleporters are followed as the queue reaches each new end
+          for(size_t t = queue.size() - 1; no == ORIENT_S && t < queue.size(); t++)
+            for(int j = 0; j < (int)teleTo.size(); j++)
+            {
+              int other = ORIENT_S * g.nbits + teleTo[j ^ 1];
+              if(queue[t] == ORIENT_S * g.nbits + teleTo[j] && !seen[other])
+              {
+                seen[other] = 1;
+                queue.push_back(other);
+              }
+            }
+        }
+      }
+      layerStart = layerEnd;
+    }
+    res.states = queue.size();
+    return res;
+}
@@ -0,0 +1,28 @@
+#ifndef REACH_H
+#define REACH_H
+
+#include "Game.h"
+
+/* Bit-parallel reachability for level validation - can the goal be reached, and in no fewer
+   than how many moves. The tile model is a superset of the game's, so the answer is only ever
+   "maybe": every bridge cell counts as floor whatever its switches do, teleporter ends lead to
+   each other both ways, and a lying block stays up while either half is on a tile. A fragile
+   tile still can't hold a standing block. goalMoves < 0 therefore proves the level unsolvable,
+   and a solution is never shorter than goalMoves.
+
+   The floor and each orientation's frontier are bitboards over the grid padded by one
+   cell all round, so one BFS layer is a handful of shifts, ORs and ANDs per 64 cells
+   (256 with AVX2) instead of one state at a time. */
+
+struct Reach {
+    int goalMoves;      // fewest moves to stand on the goal in the relaxed model, -1 if it can't be reached
+    int states;         // (orientation, cell) states reachable before the goal or in total
+};
+
+// Bitboard BFS, AVX2 when the CPU has it
+Reach reachBitboard (const Level& level);
+
+// Same search one state at a time - the reference reachBitboard must match
+Reach reachBfs (const Level& level);
+
+#endif
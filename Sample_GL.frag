@@ -2,6 +2,9 @@
 
 // Interpolated values from the vertex shaders
 in vec3 fragColor;
+in vec3 localPos;
+
+uniform int outlined;      // 1 = darken the cube edges, replacing a separate GL_LINE pass
 
 // output data
 out vec3 color;
@@ -11,4 +14,21 @@ void main()
     // Output color = color specified in the vertex shader,
     // interpolated between all 3 surrounding vertices of the triangle
     color = fragColor;
+
+    if (outlined == 1)
+    {
+        // Pixels to the cube boundary along each axis. The axis closest to +-0.5 is the face
+        // we are on, so the edge distance is the nearer of the two remaining axes.
+        vec3 a = abs(localPos);
+        vec3 px = (0.5 - a) / max(fwidth(localPos), vec3(1e-6));
+        float edge;
+        if (a.x >= a.y && a.x >= a.z)
+            edge = min(px.y, px.z);
+        else if (a.y >= a.z)
+            edge = min(px.x, px.z);
+        else
+            edge = min(px.x, px.y);
+        if (edge < 1.2)
+            color = vec3(0.0);
+    }
 }
@@ -3,19 +3,68 @@
 // input data : sent from main program
 layout (location = 0) in vec3 vertexPosition;
 layout (location = 1) in vec3 vertexColor;
+// per-instance data for the tile grid : xyz = tile translation, w = tile type
+layout (location = 2) in vec4 instanceTile;
 
-uniform mat4 MVP;
+uniform mat4 MVP;          // View * Projection only when drawing tile instances or the block
+uniform int drawMode;      // 0 = single object, 1 = tile instances, 2 = rolling block
+uniform vec3 tileScale;    // scale shared by every tile instance
+// block roll, see drawBlock() : base + pivot + R(angle, axis) * ((v + offset) * scale - pivot)
+uniform vec3 blockBase;    // centre the block rests at until the roll completes
+uniform vec3 blockScale;
+uniform vec3 blockOffset;
+uniform vec3 rollPivot;    // edge rolled about, relative to blockBase
+uniform vec3 rollAxis;
+uniform float rollAngle;   // degrees
+uniform int colorMode;     // 0 = vertex colour, 1 = objectColor, 2 = tileColors by instance tile type
+uniform vec3 objectColor;
+uniform vec3 tileColors[8];// fill colour of each tile type
 
 // output data : used by fragment shader
 out vec3 fragColor;
+out vec3 localPos;         // object space position on the unit cube, for edge detection
+
+// Rodrigues rotation of p by angle radians about axis
+vec3 rotateAbout (vec3 p, vec3 axis, float angle)
+{
+    vec3 k = normalize(axis);
+    float c = cos(angle);
+    float s = sin(angle);
+    return p * c + cross(k, p) * s + k * dot(k, p) * (1.0 - c);
+}
 
 void main ()
 {
     vec4 v = vec4(vertexPosition, 1); // Transform an homogeneous 4D vector
+    localPos = vertexPosition;
 
     // The color of each vertex will be interpolated
     // to produce the color of each fragment
-    fragColor = vertexColor;
+    if (colorMode == 1)
+        fragColor = objectColor;
+    else if (colorMode == 2)
+        fragColor = tileColors[int(instanceTile.w + 0.5)];
+    else
+        fragColor = vertexColor;
+
+    if (drawMode == 1)
+    {
+        // Emptied tiles keep their slot in the baked buffer - push them outside the clip volume
+        if (instanceTile.w < 0.5)
+        {
+            gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+            return;
+        }
+        // Tile instances carry their own translation, so the model matrix is built here
+        v = vec4(vertexPosition * tileScale + instanceTile.xyz, 1);
+    }
+    else if (drawMode == 2)
+    {
+        vec3 p = (vertexPosition + blockOffset) * blockScale;
+        if (rollAngle != 0.0)
+            p = rollPivot + rotateAbout(p - rollPivot, rollAxis, radians(rollAngle));
+        v = vec4(blockBase + p, 1);
+    }
 
     // Output position of the vertex, in clip space : MVP * position
     gl_Position = MVP * v;
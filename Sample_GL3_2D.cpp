@@ -1,11 +1,12 @@
 #include <iostream>
+#include <algorithm>
 #include <cmath>
 #include <fstream>
 #include <vector>
-#include <ao/ao.h>
-#include <mpg123.h>
 #include <unistd.h>
 #include <cstdlib>
+#include <cstring>
+#include <string>
 
 // #include <GL/glew.h>
 // #include <GL/gl.h>
@@ -16,18 +17,27 @@
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/matrix_transform.hpp>
-#define BITS 8
+
+#include "Audio.h"
+#include "Game.h"
+#include "LevelFile.h"
+#include "LevelStream.h"
+#include "Scene.h"
+#include "Trace.h"
+#include "Solver.h"
 
 using namespace std;
 
 struct VAO {
     GLuint VertexArrayID;
     GLuint VertexBuffer;
-    GLuint ColorBuffer;
+    GLuint ColorBuffer;       // 0 when colour comes from the objectColor / tileColors uniforms
+    GLuint ElementBuffer;     // 0 for non-indexed objects
 
     GLenum PrimitiveMode;
     GLenum FillMode;
     int NumVertices;
+    int NumIndices;
 };
 typedef struct VAO VAO;
 
@@ -38,17 +48,32 @@ struct GLMatrices {
     GLuint MatrixID;
 } Matrices;
 
+struct ShaderUniforms {
+    GLuint DrawModeID;
+    GLuint TileScaleID;
+    GLuint TileColorsID;
+    GLuint ColorModeID;
+    GLuint ObjectColorID;
+    GLuint OutlinedID;
+    GLuint BlockBaseID;
+    GLuint BlockScaleID;
+    GLuint BlockOffsetID;
+    GLuint RollPivotID;
+    GLuint RollAxisID;
+    GLuint RollAngleID;
+} Uniforms;
+
 int do_rot, floor_rel;;
 GLuint programID;
 double last_update_time, current_time;
 glm::vec3 rect_pos, floor_pos;
 float rectangle_rotation = 0;
 
-glm::vec3 floorPos;
 glm::vec3 floorRot = glm::vec3(0,0,0);
 
 /* Function to load Shaders - Use it as it is */
 GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path) {
+    TRACE_SCOPE("LoadShaders");
 
     // Create the shaders
     GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
@@ -131,6 +156,7 @@ static void error_callback(int error, const char* description)
 
 void quit(GLFWwindow *window)
 {
+    audioStop();
     glfwDestroyWindow(window);
     glfwTerminate();
     exit(EXIT_SUCCESS);
@@ -153,6 +179,8 @@ struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloa
     struct VAO* vao = new struct VAO;
     vao->PrimitiveMode = primitive_mode;
     vao->NumVertices = numVertices;
+    vao->NumIndices = 0;
+    vao->ElementBuffer = 0;
     vao->FillMode = fill_mode;
 
     // Create Vertex Array Object
@@ -200,11 +228,53 @@ struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloa
     return create3DObject(primitive_mode, numVertices, vertex_buffer_data, color_buffer_data, fill_mode);
 }
 
+/* Generate an indexed VAO - positions only, colour is supplied per uniform or per instance.
+   Pass an existing vertexBuffer to share its vertices, e.g. a cube's faces and its edges */
+struct VAO* createIndexed3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, int numIndices, const GLuint* index_buffer_data, GLuint vertexBuffer=0)
+{
+    struct VAO* vao = new struct VAO;
+    vao->PrimitiveMode = primitive_mode;
+    vao->NumVertices = numVertices;
+    vao->NumIndices = numIndices;
+    vao->FillMode = GL_FILL;
+    vao->ColorBuffer = 0;
+
+    glGenVertexArrays(1, &(vao->VertexArrayID)); // VAO
+    glBindVertexArray (vao->VertexArrayID); // Bind the VAO
+
+    if(vertexBuffer == 0)
+    {
+      glGenBuffers (1, &vertexBuffer); // VBO - vertices
+      glBindBuffer (GL_ARRAY_BUFFER, vertexBuffer);
+      glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), vertex_buffer_data, GL_STATIC_DRAW);
+    }
+    vao->VertexBuffer = vertexBuffer;
+    glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+
+    glGenBuffers (1, &(vao->ElementBuffer)); // EBO - indices, recorded in the VAO
+    glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, vao->ElementBuffer);
+    glBufferData (GL_ELEMENT_ARRAY_BUFFER, numIndices*sizeof(GLuint), index_buffer_data, GL_STATIC_DRAW);
+
+    return vao;
+}
+
+/* Switch polygon mode only when it actually changes - every object drawn today is GL_FILL */
+GLenum currentFillMode = GL_FILL;
+void setFillMode (GLenum fill_mode)
+{
+    if(fill_mode != currentFillMode)
+    {
+      glPolygonMode (GL_FRONT_AND_BACK, fill_mode);
+      currentFillMode = fill_mode;
+    }
+}
+
 /* Render the VBOs handled by VAO */
 void draw3DObject (struct VAO* vao)
 {
     // Change the Fill Mode for this object
-    glPolygonMode (GL_FRONT_AND_BACK, vao->FillMode);
+    setFillMode (vao->FillMode);
 
     // Bind the VAO to use
     glBindVertexArray (vao->VertexArrayID);
@@ -214,13 +284,34 @@ void draw3DObject (struct VAO* vao)
     // Bind the VBO to use
     glBindBuffer(GL_ARRAY_BUFFER, vao->VertexBuffer);
 
-    // Enable Vertex Attribute 1 - Color
-    glEnableVertexAttribArray(1);
-    // Bind the VBO to use
-    glBindBuffer(GL_ARRAY_BUFFER, vao->ColorBuffer);
+    // Enable Vertex Attribute 1 - Color, unless colour comes from a uniform
+    if(vao->ColorBuffer)
+    {
+      glEnableVertexAttribArray(1);
+      glBindBuffer(GL_ARRAY_BUFFER, vao->ColorBuffer);
+    }
 
     // Draw the geometry !
-    glDrawArrays(vao->PrimitiveMode, 0, vao->NumVertices); // Starting from vertex 0; 3 vertices total -> 1 triangle
+    if(vao->NumIndices)
+      glDrawElements(vao->PrimitiveMode, vao->NumIndices, GL_UNSIGNED_INT, (void*)0);
+    else
+      glDrawArrays(vao->PrimitiveMode, 0, vao->NumVertices); // Starting from vertex 0; 3 vertices total -> 1 triangle
+}
+
+/* Render numInstances copies of the VBOs handled by VAO - per-instance attributes must already be attached */
+void draw3DObjectInstanced (struct VAO* vao, int numInstances)
+{
+    if(numInstances <= 0)
+      return;
+    setFillMode (vao->FillMode);
+    glBindVertexArray (vao->VertexArrayID);
+    glEnableVertexAttribArray(0);
+    if(vao->ColorBuffer)
+      glEnableVertexAttribArray(1);
+    if(vao->NumIndices)
+      glDrawElementsInstanced(vao->PrimitiveMode, vao->NumIndices, GL_UNSIGNED_INT, (void*)0, numInstances);
+    else
+      glDrawArraysInstanced(vao->PrimitiveMode, 0, vao->NumVertices, numInstances);
 }
 
 
@@ -235,400 +326,110 @@ void draw3DObject (struct VAO* vao)
   float B;
 };
 
-struct tile{
-  int type;
-  glm::vec3 T;
-  glm::vec3 R;
-  glm::vec3 S;
-};
-
-struct Block
-{
-  int state,move,angle,tempAngle;
-  int speed;//Animation speed
-  int x,y,z;//Which axis to rotate around
-  glm::mat4 memoryMat;//Stores all prev transformations of block
-  float cx,cy,cz;//Current center of block
-  float tx,ty,tz;//Which edge of the block to rotate around
-  int sx,sy,sz;//Scale factor
-};
-
-vector< vector<tile> > tileGrid1;
-vector< vector<tile> > tileGrid2;
-
-vector<Block> block;
-
-float X1[4] = {-0.5,0,0,0.5};
-float Y1[4] = {-0.5,-0.5,-0.5,-0.5};
-float Z1[4] = {0,0.5,-0.5,0};
-int p = 1;
-int i = 0;
-float divY = 1,divX = 1,divZ = 1;
-glm::ivec2 blockTile[2];
-int x1 = 7,x2,ya = 3,yb;
-int lastMove=0;
-int teleXa,teleYa;
-vector<int> fragX,fragY;
-int teleXb,teleYb,pathX,pathY,goalX,goalY;
-vector<int> bridgeX,bridgeY;
-
-Block initBlock(float cx,float cy,float cz,int sx,int sy,int sz)
-{
-  Block bloc;
-  bloc.move = 0;
-  bloc.angle = 0;
-  bloc.tempAngle = 0;
-  bloc.x = bloc.y = bloc.z = 0;
-  bloc.state = 1;
-  bloc.speed = 11;
-  bloc.tx = bloc.ty = bloc.tz = 0;
-  bloc.cx = cx;
-  bloc.cy = cy;
-  bloc.cz = cz;
-  bloc.sx = sx;
-  bloc.sz = sz;
-  bloc.sy = sy;
-  return bloc;
-}
-
-
-
-GLfloat floorColor[] =
-{
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-  
-
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
+/* The rules live in Game.cpp - the renderer only animates what step() reports */
+vector<Level> levels;   // shared by every session, only their graphs are filled in after startup
+LevelPack levelPack;    // the mapped pack the levels' tiles are read from, open until exit
 
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-  
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
 
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-  
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
 
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-  
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
 
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-  
+/* Fill colour of each TileType - 0 empty, 1 floor, 2 fragile, 3 switch, 4 teleporter, 5 goal (also the block),
+   6 heavy switch, 7 bridge */
+glm::vec3 tileColor[NUM_TILE_TYPES] = {
+  glm::vec3(0,0,0),
+  glm::vec3(0.75,0.75,0.75),
+  glm::vec3(1,0,0),
+  glm::vec3(0,1,0),
+  glm::vec3(0,0,1),
+  glm::vec3(0.4,0.2,0),
+  glm::vec3(0,0.45,0),
+  glm::vec3(0.55,0.55,0.45),
 };
 
-GLfloat blockColor[] =
-{
- 0.4,0.2,0,
- 0.4,0.2,0,
- 0.4,0.2,0,
-
- 0.4,0.2,0,
- 0.4,0.2,0,
- 0.4,0.2,0,
-
- 0.4,0.2,0,
- 0.4,0.2,0,
- 0.4,0.2,0,
-
- 0.4,0.2,0,
- 0.4,0.2,0,
- 0.4,0.2,0,
-
-
- 0.4,0.2,0,
- 0.4,0.2,0,
- 0.4,0.2,0,
-
- 0.4,0.2,0,
- 0.4,0.2,0,
- 0.4,0.2,0,
-
-
- 0.4,0.2,0,
- 0.4,0.2,0,
- 0.4,0.2,0,
-
- 0.4,0.2,0,
- 0.4,0.2,0,
- 0.4,0.2,0,
-
-
- 0.4,0.2,0,
- 0.4,0.2,0,
- 0.4,0.2,0,
-
- 0.4,0.2,0,
- 0.4,0.2,0,
- 0.4,0.2,0,
-
-
- 0.4,0.2,0,
- 0.4,0.2,0,
- 0.4,0.2,0,
-
- 0.4,0.2,0,
- 0.4,0.2,0,
- 0.4,0.2,0,
+float rectangle_rot_dir = 1;
+glm::vec3 blockScale = glm::vec3(1,1,1);
+//Block block;
+bool rotLock = false;
 
+bool rectangle_rot_status = true, keys[1024], zoomin = false, zoomout = false, panr = false, panl = false;
+GLfloat lastFrame = 0.0f;   // Time of last frame
+GLfloat deltaTime = 0.0f;   // Time between current frame and last frame
+GLfloat currentFrame = 0.0f;
+/* Instanced tile grid - every tile of a level is one instance (translation + tile type),
+   so the whole floor is one draw for fills and one for borders.
+   Each level's instance buffer is streamed in once, a slice per frame, from the tile list the
+   level streaming worker prepared; a tile that changes (bridge toggled, fragile tile broken)
+   patches only its own slot with glBufferSubData.
+   Slots are never removed - an emptied tile is stored with type 0 and culled in the shader. */
+struct BakedLevel {
+    GLuint InstanceBuffer;
+    VAO *Mesh;                    // cube VAO with this level's instance stream attached
+    vector<int> Slot;             // cell (row*width + col) -> instance slot, -1 if never drawn
+    int NumInstances;
+    int Capacity;                 // slots allocated in InstanceBuffer, spare ones take new bridge tiles
+    bool Started;                 // InstanceBuffer allocated for the prepared level
+    int Uploaded;                 // instances sent so far, NumInstances once Ready
+    bool Ready;                   // fully uploaded with Slot filled in - safe to draw and patch
 };
 
-GLfloat floorColorRed[] =
+struct Camera
 {
-  1,0,0,
-  1,0,1,
-  1,0,0,
-
-  1,0,0,
-  1,0,0,
-  1,0,1,
-
-  1,0,0,
-  1,0,1,
-  1,0,0,
-
-  1,0,0,
-  1,0,1,
-  1,0,0,
-
-  1,0,0,
-  1,0,0,
-  1,0,0,
-
-  1,0,0,
-  1,0,0,
-  1,0,0,
-
-  1,0,0,
-  1,0,0,
-  1,0,0,
-
-  1,0,0,
-  1,0,0,
-  1,0,0,
-
-  1,0,0,
-  1,0,0,
-  1,0,0,
-
-  1,0,0,
-  1,0,1,
-  1,0,0,
-
-  1,0,0,
-  1,0,0,
-  1,0,0,
-
-  1,0,0,
-  1,0,0,
-  1,0,0,
+  glm::vec3 eye, front, up;
+  double yaw, pitch;
 };
 
-GLfloat floorColorGreen[] =
+Camera initCamera()
 {
-  0,1,0,
-  1,1,0,
-  0,1,0,
-
-  0,1,0,
-  0,1,0,
-  1,1,0,
-
-  0,1,0,
-  1,1,0,
-  0,1,0,
-
-  0,1,0,
-  1,1,0,
-  0,1,0,
-
-  0,1,0,
-  0,1,0,
-  0,1,0,
-
-  0,1,0,
-  0,1,0,
-  0,1,0,
-
-  0,1,0,
-  0,1,0,
-  0,1,0,
-
-  0,1,0,
-  0,1,0,
-  0,1,0,
-
-  0,1,0,
-  0,1,0,
-  0,1,0,
-
-  0,1,0,
-  1,1,0,
-  0,1,0,
-
-  0,1,0,
-  0,1,0,
-  0,1,0,
+  Camera cam;
+  cam.eye = glm::vec3(0.0f, 0.0f, 3.0f);
+  cam.front = glm::vec3(0.0f, 0.0f, -1.0f);
+  cam.up = glm::vec3(0.0f, 1.0f, 0.0f);
+  cam.yaw = cam.pitch = 0;
+  return cam;
+}
 
-  0,1,0,
-  0,1,0,
-  0,1,0,
+/* Performance overlay, toggled with F3 - CPU and GPU time of the block, tile and HUD passes and
+   a rolling graph of frame times, drawn beside the score. GPU times come from GL_TIME_ELAPSED
+   queries in two sets: frame n issues set n%2 and, before that, reads back what the same set
+   measured in frame n-2 - only once the GPU reports it available, so reading never stalls. */
+enum Pass {
+  PASS_BLOCK,
+  PASS_TILES,
+  PASS_HUD,
+  NUM_PASSES
 };
-GLfloat floorColorBlue[] =
-{
-  0,0,1,
-  1,0,1,
-  0,0,1,
-
-  0,0,1,
-  0,0,1,
-  1,0,1,
-
-  0,0,1,
-  1,0,1,
-  0,0,1,
-
-  0,0,1,
-  1,0,1,
-  0,0,1,
-
-  0,0,1,
-  0,0,1,
-  0,0,1,
-
-  0,0,1,
-  0,0,1,
-  0,0,1,
-
-  0,0,1,
-  0,0,1,
-  0,0,1,
-
-  0,0,1,
-  0,0,1,
-  0,0,1,
-
-  0,0,1,
-  0,0,1,
-  0,0,1,
-
-  0,0,1,
-  1,0,1,
-  0,0,1,
-
-  0,0,1,
-  0,0,1,
-  0,0,1,
-
-  0,0,1,
-  0,0,1,
-  0,0,1,
+#define PERF_HISTORY 120
+struct PerfOverlay {
+  bool shown;
+  int frame;                      // parity picks the query set
+  bool issued[2];                 // set has queries in flight, over every session
+  double passStart;               // glfwGetTime() at perfBegin()
+  double cpuMs[NUM_PASSES];       // issuing each pass this frame, summed over sessions
+  double cpuShown[NUM_PASSES];    // the last whole frame's cpuMs
+  double gpuMs[NUM_PASSES];       // latest read back, summed over sessions
+  float frameMs[PERF_HISTORY];    // ring of whole-frame times
+  int head;                       // next slot in frameMs
 };
+PerfOverlay perf;
 
-GLfloat borderColor[] =
+/* One game with everything it needs to be played and drawn - rules state, the blocks being
+   animated, its own copy of the tile buffers and its own camera. Sessions share nothing but
+   the read-only levels and meshes, so several can be played side by side, and their GameStates
+   can be stepped on different threads. */
+struct Session
 {
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-  
-
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-  
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-
-  0,0,0,
-  0,0,0,
-  0,0,0,
-  
-  0,0,0,
-  0.75,0.75,0.75,
-  0,0,0,
-
-
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-  
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
-  0.75,0.75,0.75,
+  GameState game;
+  int shownLevel;                 // level on screen, switches to game.level once the winning roll has been shown
+  vector<Block> block;
+  vector<BakedLevel> bakedLevel;
+  Camera camera;
+  bool over;                      // won or out of lives, no longer simulated
+  GLuint passQuery[2][NUM_PASSES];  // GL_TIME_ELAPSED per pass, one set per frame parity
 };
 
-int currColor = 1;
-int floorWidth = 20;
-int floorHeight = 10;
-int drop[2] = {0,0};
-int kill[2] = {0,0};
-float rectangle_rot_dir = 1;
-int c = 0;
-glm::vec3 blockScale = glm::vec3(1,1,1);
-//Block block;
-bool rotLock = false;
-
-bool rectangle_rot_status = true, keys[1024], zoomin = false, zoomout = false, panr = false, panl = false;
-GLfloat lastFrame = 0.0f;   // Time of last frame
-GLfloat deltaTime = 0.0f;   // Time between current frame and last frame
-GLfloat currentFrame = glfwGetTime();
-glm::vec3 eye = glm::vec3(0.0f, 0.0f, 3.0f);
-glm::vec3 front = glm::vec3(0.0f, 0.0f, -1.0f);
-glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f);
+vector<Session> sessions;
+int activeSession = 0;            // the one keyboard and mouse drive, Tab cycles
 
-int moves = 0;
-int splitz = 0;
-int lives = 3;
 
 /* Executed when a regular key is pressed/released/held-down */
 /* Prefered for Keyboard events */
@@ -737,38 +538,44 @@ int lives = 3;
   }
 }*/
 
-int score = 0;
+glm::vec3 floorPos;
+
+/* Apply the move to the game and start animating it from the current pose */
+void startRoll (Session &s, Move m)
+{
+  Block &bl = s.block[0];
+  // One roll at a time - keys pressed mid-roll or mid-fall are dropped
+  if(bl.move != 0 || bl.falling || s.game.status != PLAYING)
+    return;
+
+  beginRoll(bl, m, step(s.game, m));
+  audioPlaySfx(SFX_MOVE);
+}
 
 void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
 {
-  int b = c;
-  float shiftSide = 1.5;
-  float shiftDown = 0.5;
-  if(p == 2)
-  {
-    shiftSide = 1;
-    shiftDown = 0;
-  }  
+  Session &s = sessions[activeSession];
+  Camera &cam = s.camera;
   GLfloat cameraSpeed = 0.10f;
   if(key == GLFW_KEY_W)
-      eye += cameraSpeed * front;
+      cam.eye += cameraSpeed * cam.front;
   if(key == GLFW_KEY_S)
-      eye -= cameraSpeed * front;
+      cam.eye -= cameraSpeed * cam.front;
   if(key == GLFW_KEY_A)
-      eye -= glm::normalize(glm::cross(front, up)) * cameraSpeed;
+      cam.eye -= glm::normalize(glm::cross(cam.front, cam.up)) * cameraSpeed;
   if(key == GLFW_KEY_D)
-      eye += glm::normalize(glm::cross(front, up)) * cameraSpeed;
+      cam.eye += glm::normalize(glm::cross(cam.front, cam.up)) * cameraSpeed;
    if(key == GLFW_KEY_T)
   {
-    eye = glm::vec3(0.0f, 5.0f, -floorHeight/2);
-    front = glm::vec3(0.0f, -1.0f, 0.0f);
-    up = glm::vec3(0.0f, 0.0f, -1.0f);
+    cam.eye = glm::vec3(0.0f, 5.0f, -levels[s.shownLevel].height/2);
+    cam.front = glm::vec3(0.0f, -1.0f, 0.0f);
+    cam.up = glm::vec3(0.0f, 0.0f, -1.0f);
   }  
   if(key == GLFW_KEY_N)
   {
-    eye = glm::vec3(0.0f, 0.0f, 3.0f);
-    front = glm::vec3(0.0f, 0.0f, -1.0f);
-    up = glm::vec3(0.0f, 1.0f, 0.0f);
+    cam.eye = glm::vec3(0.0f, 0.0f, 3.0f);
+    cam.front = glm::vec3(0.0f, 0.0f, -1.0f);
+    cam.up = glm::vec3(0.0f, 1.0f, 0.0f);
   }     
     // Function is called first on GLFW_PRESS.
   if (action == GLFW_PRESS) {
@@ -779,216 +586,43 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
   case GLFW_KEY_J:
       join();
       break;*/
+  case GLFW_KEY_TAB:
+      activeSession = (activeSession + 1) % sessions.size();
+      break;
+  case GLFW_KEY_F3:
+      perf.shown = !perf.shown;
+      break;
   case GLFW_KEY_LEFT:
-      score++;
-      system("echo -e \"\a\"");
-      moves = 1;
-      block[b].move = 1;
-      block[b].angle = 88;
-      i = 0;
-      if(p == 1)
-      {
-
-        if(block[b].state == 1)
-        {
-          block[b].state = 2;
-          block[b].cy -= shiftDown;
-          block[b].cx -= shiftSide;
-          divY = 0.5;
-          x2=x1-2;
-          yb=ya;
-          x1--;
-        }
-        else if(block[b].state == 2)
-        {
-          block[b].state = 1;
-          block[b].cx -= shiftSide;
-          block[b].cy += shiftDown;
-          divX = 0.5;
-          x2=x1-1;
-          yb=ya;
-          x1-=2;
-        }
-        else if(block[b].state == 3)
-        {
-          block[b].cx -= 1;
-          x2=x2-1;
-          x1--;
-        }
-      }
-      else
-      {
-        if(b == 0)
-        {
-          x1--;
-        }
-        else
-          x2--;
-        block[b].cx -= shiftSide;
-      }
-      block[b].x = 0;block[b].y = 0;block[b].z = 1;
+      startRoll(s, MOVE_LEFT);
       break;
   case GLFW_KEY_RIGHT:
-      score++;
-      system("echo -e \"\a\"");
-      moves = 2;
-      block[b].move = 1;
-      block[b].angle = -88;
-      i = 3;
-      if(p == 1)
-      {
-      if(block[b].state == 1)
-      {
-        block[b].state = 2;
-        block[b].cx += shiftSide;
-        block[b].cy -= shiftDown;
-        divY = 0.5;
-        x2=x1+1;
-        yb=ya;
-        x1 = x1 + 2;
-      }
-      else if(block[b].state == 2)
-      {
-        block[b].state = 1;
-        block[b].cx += shiftSide;
-        block[b].cy += shiftDown;
-        divX = 0.5;
-        x2=x2+2;
-        yb=ya;
-        x1 += 1;
-      }
-      else if(block[b].state == 3)
-      {
-        block[b].cx += 1;
-        x2=x2+1;
-        x1 += 1;
-      }
-      }
-      else
-      {
-        if(b == 0)
-        {
-          x1++;
-        }
-        else
-          x2++;
-        block[b].cx += shiftSide;
-      }
-      block[b].x = 0;block[b].y = 0;block[b].z = 1;
+      startRoll(s, MOVE_RIGHT);
       break;
   case GLFW_KEY_UP:
-      score++;
-      system("echo -e \"\a\"");
-      moves = 3;
-      block[b].move = -1;
-      block[b].angle = -88;
-      i = 2;
-      if(p == 1)
-      {
-      if(block[b].state == 1)
-      {
-        block[b].state = 3;
-        block[b].cz -= shiftSide;
-        block[b].cy -= shiftDown;
-        divY = 0.5;
-        yb=ya+2;
-        x2=x1;
-        ya++;
-      }
-      else if(block[b].state == 2)
-      {
-        block[b].cz -= 1;
-        yb++;
-        ya++;
-      }
-      else if(block[b].state == 3)
-      {
-        block[b].state = 1;
-        block[b].cz -= shiftSide;
-        block[b].cy += shiftDown;
-        divZ = 0.5;
-        yb=ya+1;
-        ya+=2;
-      }
-      }
-      else
-      {
-        if(b == 0)
-        {
-          ya++;
-        }
-        else
-          yb++;
-        block[b].cz -= shiftSide;
-      }
-      block[b].x = 1;block[b].y = 0;block[b].z = 0;
+      startRoll(s, MOVE_UP);
       break;
   case GLFW_KEY_DOWN:
-      score++;
-      system("echo -e \"\a\"");
-      moves = 4;
-      block[b].move = -1;
-      block[b].angle = 88;
-      i = 1;
-      if(p == 1)
-      {
-      if(block[b].state == 1)
-      {
-        block[b].state = 3;
-        block[b].cz += shiftSide;
-        block[b].cy -= shiftDown;
-        divY = 0.5;
-        yb=ya-1;
-        x2=x1;
-        ya-=2;
-      }
-      else if(block[b].state == 2)
-      {
-        block[b].cz += 1;
-        yb--;
-        ya--;
-      }
-      else if(block[b].state == 3)
-      {
-        block[b].state = 1;
-        block[b].cz += shiftSide;
-        block[b].cy += shiftDown;
-        divZ = 0.5;
-        yb=ya-2;
-        ya-=1;
-      }
-      }
-      else
-      {
-        if(b == 0)
-        {
-          ya--;
-        }
-        else
-          yb--;
-        block[b].cz += shiftSide;
-      }
-      block[b].x = 1;block[b].y = 0;block[b].z = 0;
-      break;      
+      startRoll(s, MOVE_DOWN);
+      break;
   default:
       break;
         }
-        // cout << x1 << " " << ya << " "<< x2 << " " << yb << endl;
     }
 }
 
 
 void do_movement()
 {
+    Camera &cam = sessions[activeSession].camera;
     GLfloat cameraSpeed = 5.0f * deltaTime;
     if(keys[GLFW_KEY_W])
-        eye += cameraSpeed * front;
+        cam.eye += cameraSpeed * cam.front;
     if(keys[GLFW_KEY_S])
-        eye -= cameraSpeed * front;
+        cam.eye -= cameraSpeed * cam.front;
     if(keys[GLFW_KEY_A])
-        eye -= glm::normalize(glm::cross(front, up))*cameraSpeed;
+        cam.eye -= glm::normalize(glm::cross(cam.front, cam.up))*cameraSpeed;
     if(keys[GLFW_KEY_D])
-        eye += glm::normalize(glm::cross(front, up))*cameraSpeed;
+        cam.eye += glm::normalize(glm::cross(cam.front, cam.up))*cameraSpeed;
 }
 
 /* Executed for character input (like in text boxes) */
@@ -1017,10 +651,11 @@ void mouseButton (GLFWwindow* window, int button, int action, int mods)
 
 
 
+float farPlane = 100.0f;   // of the session projections, pushed out by --bench for big levels
+
 /* Executed when window is resized to 'width' and 'height' */
 /* Modify the bounds of the screen here in glm::ortho or Field of View in glm::Perspective */
 GLfloat fov = 90.0f;
-double yaw, pitch;
 GLfloat lastX = 683, lastY = 384;
 bool firstMouse = true;
 void mouse_callback(GLFWwindow* window, double xpos, double ypos)
@@ -1041,19 +676,20 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
     xoffset *= sensitivity;
     yoffset *= sensitivity;
 
-    yaw   += xoffset;
-    pitch += yoffset;
+    Camera &cam = sessions[activeSession].camera;
+    cam.yaw   += xoffset;
+    cam.pitch += yoffset;
 
-    if(pitch > 89.0f)
-        pitch = 89.0f;
-    if(pitch < -89.0f)
-        pitch = -89.0f;
+    if(cam.pitch > 89.0f)
+        cam.pitch = 89.0f;
+    if(cam.pitch < -89.0f)
+        cam.pitch = -89.0f;
 
     glm::vec3 ffront;
-    ffront.x = cos(glm::radians(yaw)) * cos(glm::radians(pitch));
-    ffront.y = sin(glm::radians(pitch));
-    ffront.z = sin(glm::radians(yaw)) * cos(glm::radians(pitch));
-    front = glm::normalize(ffront);
+    ffront.x = cos(glm::radians(cam.yaw)) * cos(glm::radians(cam.pitch));
+    ffront.y = sin(glm::radians(cam.pitch));
+    ffront.z = sin(glm::radians(cam.yaw)) * cos(glm::radians(cam.pitch));
+    cam.front = glm::normalize(ffront);
 }  
 
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
@@ -1083,153 +719,310 @@ void reshapeWindow (GLFWwindow* window, int width, int height)
     //Matrices.projection = glm::ortho(-4.0f, 4.0f, -4.0f, 4.0f, 0.1f, 500.0f);
 }
 
-VAO *rectangle, *cam, *floor_vao,*sevenSeg;
-
-void createSevenSeg()
-{
-  static const GLfloat vertex_buffer_data [] = {
-    -0.02,-0.02,0, // vertex 1
-    0.02,-0.02,0, // vertex 2
-    0.02, 0.2,0, // vertex 3
-
-    0.02, 0.2,0, // vertex 3
-    -0.02, 0.2,0, // vertex 4
-    -0.02,-0.02,0  // vertex 1
-  };
-
-  static const GLfloat color_buffer_data [] = {
-    0,0,0, // color 1
-    0,0,0, // color 2
-    0,0,0, // color 3
-
-    0,0,0, // color 3
-    0,0,0, // color 4
-    0,0,0  // color 1
-  };
+VAO *cam, *floor_vao;
 
-  // create3DObject creates and returns a handle to a VAO that can be used later
-  sevenSeg = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
-}
+/* Unit cube shared by every box-shaped object - tiles, the block and the score segments.
+   8 indexed corners, the black edges are drawn by the fragment shader in the same pass */
+VAO *cubeMesh;
 
-// Creates the rectangle object used in this sample code
-void createRectangle ()
+void createCube ()
 {
-    // GL3 accepts only Triangles. Quads are not supported
     static const GLfloat vertex_buffer_data [] = {
-	-0.5, 0.5, 0.5, 
-	-0.5, -0.5, 0.5, 
-	0.5, -0.5, 0.5,
-	-0.5, 0.5, 0.5, 
-	0.5, -0.5, 0.5,
-	0.5, 0.5, 0.5,
-	0.5, 0.5, 0.5,
-	0.5, -0.5, 0.5,
-	0.5, -0.5, -0.5,
-	0.5, 0.5, 0.5,
-	0.5, -0.5, -0.5,
-	0.5, 0.5, -0.5,
-	0.5, 0.5, -0.5,
-	0.5, -0.5, -0.5,
-	-0.5, -0.5, -0.5,
-	0.5, 0.5, -0.5,
-	-0.5, -0.5, -0.5,
-	-0.5, 0.5, -0.5,
-	-0.5, 0.5, -0.5,
-	-0.5, -0.5, -0.5,
-	-0.5, -0.5, 0.5, 
-	-0.5, 0.5, -0.5,
-	-0.5, -0.5, 0.5, 
-	-0.5, 0.5, 0.5, 
-	-0.5, 0.5, -0.5,
-	-0.5, 0.5, 0.5, 
-	0.5, 0.5, 0.5,
-	-0.5, 0.5, -0.5,
-	0.5, 0.5, 0.5,
-	0.5, 0.5, -0.5,
-	-0.5, -0.5, 0.5, 
-	-0.5, -0.5, -0.5,
-	0.5, -0.5, -0.5,
-	-0.5, -0.5, 0.5, 
-	0.5, -0.5, -0.5,
-	0.5, -0.5, 0.5,
-	-0.5, 0.5, 0.5,
-	0.5, 0.5, -0.5,
-	0.5, 0.75, -0.5,
+	-0.5, -0.5, -0.5, // 0
+	0.5, -0.5, -0.5,  // 1
+	0.5, 0.5, -0.5,   // 2
+	-0.5, 0.5, -0.5,  // 3
+	-0.5, -0.5, 0.5,  // 4
+	0.5, -0.5, 0.5,   // 5
+	0.5, 0.5, 0.5,    // 6
+	-0.5, 0.5, 0.5,   // 7
+    };
+
+    static const GLuint face_index_data [] = {
+	4, 5, 6,  4, 6, 7, // front
+	1, 0, 3,  1, 3, 2, // back
+	5, 1, 2,  5, 2, 6, // right
+	0, 4, 7,  0, 7, 3, // left
+	7, 6, 2,  7, 2, 3, // top
+	0, 1, 5,  0, 5, 4, // bottom
     };
 
-    if(currColor == 1)
-    rectangle = create3DObject(GL_TRIANGLES, 12*3 , vertex_buffer_data, floorColor, GL_FILL);
-    else if(currColor == 2)
-    rectangle = create3DObject(GL_TRIANGLES, 12*3 , vertex_buffer_data, floorColorRed, GL_FILL);
-    else if(currColor == 3)
-    rectangle = create3DObject(GL_TRIANGLES, 12*3 , vertex_buffer_data, floorColorGreen, GL_FILL);
-    else if(currColor == 4)
-    rectangle = create3DObject(GL_TRIANGLES, 12*3 , vertex_buffer_data, floorColorBlue, GL_FILL);
-else if(currColor == 5)
-    rectangle = create3DObject(GL_TRIANGLES, 12*3 , vertex_buffer_data, blockColor, GL_FILL);
-
- 
+    cubeMesh = createIndexed3DObject(GL_TRIANGLES, 8, vertex_buffer_data, 12*3, face_index_data);
 }
 
-void createRectangleBorder ()
+// Colour for the following non-instanced draws
+void setObjectColor (glm::vec3 color)
 {
-GLfloat vertex_buffer_data [] = {
-    -0.5, 0.5, 0.5,
-    -0.5, -0.5, 0.5,
-    0.5, -0.5, 0.5,
-
-    -0.5, 0.5, 0.5,
-    0.5, -0.5, 0.5,
-    0.5, 0.5, 0.5,
-
-    0.5, 0.5, 0.5,
-    0.5, -0.5, 0.5,
-    0.5, -0.5, -0.5,
+    glUniform1i(Uniforms.ColorModeID, 1);
+    glUniform3f(Uniforms.ObjectColorID, color.x, color.y, color.z);
+}
 
-    0.5, 0.5, 0.5,
-    0.5, -0.5, -0.5,
-    0.5, 0.5, -0.5,
 
-    0.5, 0.5, -0.5,
-    0.5, -0.5, -0.5,
-    -0.5, -0.5, -0.5,
+// New VAO sharing the vertex and index buffers of src, so per-level VAOs upload no geometry
+struct VAO* cloneVAO (struct VAO* src)
+{
+    struct VAO* vao = new struct VAO(*src);
+    glGenVertexArrays(1, &(vao->VertexArrayID));
+    glBindVertexArray (vao->VertexArrayID);
+    glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    if(vao->ColorBuffer)
+    {
+      glBindBuffer (GL_ARRAY_BUFFER, vao->ColorBuffer);
+      glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    }
+    if(vao->ElementBuffer)
+      glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, vao->ElementBuffer);
+    return vao;
+}
 
-    0.5, 0.5, -0.5,
-    -0.5, -0.5, -0.5,
-    -0.5, 0.5, -0.5,
+// Attach an instance stream as attribute 2 of the VAO, advancing once per instance
+void attachTileInstances (struct VAO* vao, GLuint instanceBuffer)
+{
+    glBindVertexArray (vao->VertexArrayID);
+    glBindBuffer (GL_ARRAY_BUFFER, instanceBuffer);
+    glVertexAttribPointer(
+                          2,                  // attribute 2. Tile instance
+                          4,                  // size (x,y,z,type)
+                          GL_FLOAT,           // type
+                          GL_FALSE,           // normalized?
+                          0,                  // stride
+                          (void*)0            // array buffer offset
+                          );
+    glEnableVertexAttribArray(2);
+    glVertexAttribDivisor(2, 1);
+}
 
-    -0.5, 0.5, -0.5,
-    -0.5, -0.5, -0.5,
-    -0.5, -0.5, 0.5,
+// Read back the query set this frame is about to reuse, then start counting the frame's CPU time
+void perfFrameStart ()
+{
+  int set = perf.frame & 1;
+  for(int p = 0; p < NUM_PASSES; p++)
+  {
+    perf.cpuShown[p] = perf.cpuMs[p];
+    perf.cpuMs[p] = 0;
+  }
+  if(!perf.issued[set])
+    return;
+  perf.issued[set] = false;
+  // Queries finish in order, so the last pass of the last session being done means all are
+  GLint available = 0;
+  glGetQueryObjectiv(sessions.back().passQuery[set][NUM_PASSES - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+  if(!available)
+    return;
+  for(int p = 0; p < NUM_PASSES; p++)
+  {
+    double total = 0;
+    for(int n = 0; n < (int)sessions.size(); n++)
+    {
+      GLuint64 ns = 0;
+      glGetQueryObjectui64v(sessions[n].passQuery[set][p], GL_QUERY_RESULT, &ns);
+      total += ns / 1e6;
+    }
+    perf.gpuMs[p] = total;
+  }
+}
 
-    -0.5, 0.5, -0.5,
-    -0.5, -0.5, 0.5,
-    -0.5, 0.5, 0.5,
+void perfFrameEnd (float frameMs)
+{
+  perf.frameMs[perf.head] = frameMs;
+  perf.head = (perf.head + 1) % PERF_HISTORY;
+  if(perf.shown)
+    perf.issued[perf.frame & 1] = true;
+  perf.frame++;
+}
 
-    -0.5, 0.5, -0.5,
-    -0.5, 0.5, 0.5,
-    0.5, 0.5, 0.5,
+void perfBegin (const Session &s, Pass p)
+{
+  if(!perf.shown)
+    return;
+  glBeginQuery(GL_TIME_ELAPSED, s.passQuery[perf.frame & 1][p]);
+  perf.passStart = glfwGetTime();
+}
 
-    -0.5, 0.5, -0.5,
-    0.5, 0.5, 0.5,
-    0.5, 0.5, -0.5,
+void perfEnd (Pass p)
+{
+  if(!perf.shown)
+    return;
+  perf.cpuMs[p] += (glfwGetTime() - perf.passStart)*1000;
+  glEndQuery(GL_TIME_ELAPSED);
+}
 
-    -0.5, -0.5, 0.5,
-    -0.5, -0.5, -0.5,
-    0.5, -0.5, -0.5,
+// Tile centre for (row j, column i) of a level
+glm::vec3 tilePosition (int j, int i)
+{
+    return floorPos + glm::vec3(i,0,-j);
+}
 
-    -0.5, -0.5, 0.5,
-    0.5, -0.5, -0.5,
-    0.5, -0.5, 0.5,
+void bakeLevel (Session &s, int lvl)
+{
+    BakedLevel &bl = s.bakedLevel[lvl];
+    const Level &level = levels[lvl];
+    // The level being played bakes its live grid, the others their initial layout
+    const unsigned char *grid = lvl == s.game.level ? &s.game.tiles[0] : levelCells(level);
+    vector<glm::vec4> instances;
+    listTileInstances(grid, level.width, level.height, floorPos, instances, bl.Slot);
+    bl.NumInstances = instances.size();
+    // Headroom for bridges that appear later without rebaking
+    bl.Capacity = bl.NumInstances + 32;
+
+    if(bl.Mesh == NULL)
+    {
+      glGenBuffers (1, &bl.InstanceBuffer);
+      bl.Mesh = cloneVAO(cubeMesh);
+      attachTileInstances(bl.Mesh, bl.InstanceBuffer);
+    }
+    glBindBuffer (GL_ARRAY_BUFFER, bl.InstanceBuffer);
+    glBufferData (GL_ARRAY_BUFFER, bl.Capacity*sizeof(glm::vec4), NULL, GL_DYNAMIC_DRAW);
+    if(bl.NumInstances > 0)
+      glBufferSubData (GL_ARRAY_BUFFER, 0, bl.NumInstances*sizeof(glm::vec4), &instances[0]);
+    bl.Started = bl.Ready = true;
+    bl.Uploaded = bl.NumInstances;
+}
 
-    };
+/* Streaming - the worker in LevelStream.cpp prepares the next level while this one is played.
+   Its graph is installed once, then every session uploads its tiles UPLOAD_SLICE instances a
+   frame, so entering a level never waits on a whole-level upload. A level entered before the
+   worker is done with it is never waited for either: it is checked and baked on the spot and
+   played on the rules until its graph arrives. */
+#define UPLOAD_SLICE 4096
+vector<char> graphInstalled;      // by level
+vector<char> tilesChecked;        // by level: 0 not yet, 1 fine, -1 broken - for levels entered early
+
+// checkLevelTiles() on the main thread, once per level, for a level the worker hasn't finished
+bool levelTilesOk (int lvl)
+{
+    if(tilesChecked[lvl] == 0)
+      tilesChecked[lvl] = checkLevelTiles(levels[lvl]) ? 1 : -1;
+    return tilesChecked[lvl] > 0;
+}
 
+// Hand a prepared level's graph to the engine and move games already on the level onto it
+void installLevel (PreparedLevel &p)
+{
+    if(graphInstalled[p.level])
+      return;
+    graphInstalled[p.level] = 1;
+    if(!p.valid)
+      return;
+    swap(levels[p.level].graph, p.graph);
+    for(int n = 0; n < (int)sessions.size(); n++)
+      if(sessions[n].game.level == p.level)
+        attachGraph(sessions[n].game);
+}
 
-    // create3DObject creates and returns a handle to a VAO that can be used later
-    rectangle = create3DObject(GL_TRIANGLES, 12*3 , vertex_buffer_data, borderColor, GL_LINE);
+// Allocate level lvl's instance buffer for the prepared tile list, nothing uploaded yet
+void startBake (Session &s, int lvl, const PreparedLevel &p)
+{
+    BakedLevel &bl = s.bakedLevel[lvl];
+    bl.NumInstances = p.tileCells.size();
+    bl.Capacity = bl.NumInstances + 32;
+    bl.Uploaded = 0;
+    bl.Started = true;
+    bl.Ready = false;
+    if(bl.Mesh == NULL)
+    {
+      glGenBuffers (1, &bl.InstanceBuffer);
+      bl.Mesh = cloneVAO(cubeMesh);
+      attachTileInstances(bl.Mesh, bl.InstanceBuffer);
+    }
+    glBindBuffer (GL_ARRAY_BUFFER, bl.InstanceBuffer);
+    glBufferData (GL_ARRAY_BUFFER, bl.Capacity*sizeof(glm::vec4), NULL, GL_DYNAMIC_DRAW);
 }
 
-void createCam ()
+// Upload up to count more of level lvl's instances - the last slice makes it Ready
+void uploadSlice (Session &s, int lvl, const PreparedLevel &p, int count)
+{
+    BakedLevel &bl = s.bakedLevel[lvl];
+    const Level &level = levels[lvl];
+    const unsigned char *cells = levelCells(level);
+    int end = min(bl.NumInstances, bl.Uploaded + count);
+    vector<glm::vec4> instances;
+    instances.reserve(end - bl.Uploaded);
+    appendTileInstances(cells, level.width, &p.tileCells[bl.Uploaded], end - bl.Uploaded, floorPos, instances);
+    if(!instances.empty())
+    {
+      glBindBuffer (GL_ARRAY_BUFFER, bl.InstanceBuffer);
+      glBufferSubData (GL_ARRAY_BUFFER, bl.Uploaded*sizeof(glm::vec4), instances.size()*sizeof(glm::vec4), &instances[0]);
+    }
+    bl.Uploaded = end;
+    if(end == bl.NumInstances)
+    {
+      bl.Slot = p.slot;
+      bl.Ready = true;
+    }
+}
+
+// Once a frame: install what the worker finished and upload a slice of each session's
+// current and next level
+void streamLevels ()
+{
+    for(int n = 0; n < (int)sessions.size(); n++)
+    {
+      Session &s = sessions[n];
+      for(int l = s.shownLevel; l <= s.shownLevel + 1 && l < (int)levels.size(); l++)
+      {
+        PreparedLevel *p = levelStreamPoll(l);
+        if(p == NULL || !p->valid)
+          continue;
+        installLevel(*p);
+        BakedLevel &bl = s.bakedLevel[l];
+        if(bl.Ready)
+          continue;
+        if(!bl.Started)
+          startBake(s, l, *p);
+        uploadSlice(s, l, *p, UPLOAD_SLICE);
+      }
+    }
+}
+
+// Make level lvl playable and drawable for s now and queue the level after it. Normally the
+// worker and streamLevels() have done that already; if not, the level is baked here and its
+// graph attached by streamLevels() once the worker has built it. False if the level is broken.
+bool enterLevel (Session &s, int lvl)
+{
+    levelStreamRequest(lvl);
+    levelStreamRequest(lvl + 1);
+    PreparedLevel *p = levelStreamPoll(lvl);
+    BakedLevel &bl = s.bakedLevel[lvl];
+    if(p == NULL)
+    {
+      TRACE_SCOPE("enter unprepared level");
+      if(!levelTilesOk(lvl))
+        return false;
+      if(!bl.Ready)
+        bakeLevel(s, lvl);
+      return true;
+    }
+    if(!p->valid)
+      return false;
+    installLevel(*p);
+    if(!bl.Ready)
+    {
+      if(!bl.Started)
+        startBake(s, lvl, *p);
+      uploadSlice(s, lvl, *p, bl.NumInstances);
+    }
+    return true;
+}
+
+// Re-upload the single instance for tile (row j, column i) of the level being played after its type changed
+void patchTile (Session &s, int j, int i)
+{
+    int lvl = s.game.level;
+    BakedLevel &bl = s.bakedLevel[lvl];
+    glm::vec4 instance;
+    int slot = patchTileInstance(&s.game.tiles[0], s.game.width, j*s.game.width + i, floorPos,
+                                 bl.Slot, bl.NumInstances, bl.Capacity, instance);
+    if(slot == -2)
+      bakeLevel(s, lvl);
+    if(slot < 0)
+      return;
+    glBindBuffer (GL_ARRAY_BUFFER, bl.InstanceBuffer);
+    glBufferSubData (GL_ARRAY_BUFFER, slot*sizeof(glm::vec4), sizeof(glm::vec4), &instance);
+}
+
+void createCam ()
 {
     // GL3 accepts only Triangles. Quads are not supported
     static const GLfloat vertex_buffer_data [] = {
@@ -1274,700 +1067,222 @@ void createFloor ()
     floor_vao = create3DObject(GL_TRIANGLES, 2*3, vertex_buffer_data, color_buffer_data, GL_FILL);
 }
 
-int level = 1;
-
-int lvlone[10][20] = {
-    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,1,1,1,0,0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,1,1,1,1,2,1,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,1,1,3,1,1,1,0,0,1,1,1,1,0,0},
-    {0,0,0,0,0,0,0,1,1,1,1,1,0,0,1,1,1,1,1,0},
-    {0,0,0,0,0,0,0,0,0,0,0,1,0,0,1,5,1,1,1,0},
-    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,1,1,1,1,0,0},
-    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0}
-  };
-
-int lvltwo[10][20] = {
-    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
-    {1,4,1,0,0,1,1,1,1,1,0,0,1,1,1,1,0,0,0,0},
-    {1,1,1,0,0,1,1,1,1,4,0,0,1,5,1,1,0,0,0,0},
-    {1,1,1,0,0,1,1,1,1,1,0,0,1,1,2,1,0,0,0,0},
-    {3,1,1,0,0,1,1,1,1,1,0,0,1,1,1,1,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
-    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0}
-  };
-
 float camera_rotation_angle = 90;
 
 
-glm::mat4 genModelMatrix(glm::vec3 translate, glm::vec3 rotation , glm::vec3 scale)
-{
-  glm::mat4 tempScale = glm::scale(glm::mat4(1.0f),scale);
-  glm::mat4 tempTranslate = glm::translate(translate);
-  glm::mat4 tempRotateZ = glm::rotate((float)(rotation.z * M_PI/180.0f ),glm::vec3(0,0,1));
-  glm::mat4 tempRotateY = glm::rotate((float)(rotation.y * M_PI/180.0f) ,glm::vec3(0,1,0));
-  glm::mat4 tempRotateX = glm::rotate((float)(rotation.x * M_PI/180.0f),glm::vec3(1,0,0));
-  return tempTranslate*tempRotateX*tempRotateY*tempRotateZ*tempScale;
-  // glm::mat4 T = glm::rotate((float)((90 - camera_rotation_angle)*M_PI/180.0f), glm::vec3(0,1,0));
-
-  // return tempTranslate * tempScale;
-}
-int done = 0;
-
-
-float ssx[7] = {3.5,3.5,3.5,3.5,3.5,3.7,3.7};
-float ssy[7] = {3.5,3.2,3.45,3.15,3.75,3.5,3.2};
-float ssa[7] = {0,0,-90,-90,-90,0,0};
-float vis[7] = {1,1,1,1,1,1,1};
-
-void drawPrintScore(glm::mat4 VP, glm::mat4 MVP)
+// Draw one digit, segments as digitSegments() gives them, dx along the score line
+void drawDigit(int segments, float dx, glm::mat4 VP)
 {
-  int first = score % 10;
-  int temp = score/10;
-  int sec = temp % 100;
-  int firstP = lives % 10;
-
-  switch(firstP)
-  {
-    case 0:
-          vis[2] = 0;
-          break;
-    case 1:
-          vis[2] = vis[3] = vis[4] = vis[5] = vis[6] = 0;
-          break;
-    case 2:
-          vis[0] = vis[6] = 0;
-          break;
-    case 3:
-          vis[0] = vis[1] = 0;
-          break;
-    case 4:
-          vis[1] = vis[4] = vis[3] = 0;
-          break;
-    case 5:
-          vis[1] = vis[5] = 0;
-          break;
-    case 6:
-          vis[5] = 0;
-          break;
-    case 7:
-          vis[0] = vis[1] = vis[2] = vis[3] = 0;
-          break;
-    case 8:
-          break;
-    case 9:
-          vis[1] = 0;
-  }
   for(int i = 0;i<7;i++)
   {
-    if(vis[i] == 1)
+    if(segments & (1 << i))
     {
-      Matrices.model = glm::mat4(1.0f);
-      glm::mat4 translateRectangle = glm::translate (glm::vec3(ssx[i] - 7, ssy[i], 0));        // glTranslatef
-      glm::mat4 rotateRectangle = glm::rotate((float)(ssa[i]*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)    Matrices.model *= (translateRectangle);
-      Matrices.model *= (translateRectangle * rotateRectangle);
-      MVP = VP * Matrices.model;
+      Matrices.model = segmentModel(i, dx);
+      glm::mat4 MVP = VP * Matrices.model;
       glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-      draw3DObject(sevenSeg);
+      draw3DObject(cubeMesh);
     }
   }
-  vis[0] = vis[1] = vis[2] = vis[3] = vis[4] = vis[5] = vis[6] = 1;
+}
 
-  switch(first)
-  {
-    case 0:
-          vis[2] = 0;
-          break;
-    case 1:
-          vis[2] = vis[3] = vis[4] = vis[5] = vis[6] = 0;
-          break;
-    case 2:
-          vis[0] = vis[6] = 0;
-          break;
-    case 3:
-          vis[0] = vis[1] = 0;
-          break;
-    case 4:
-          vis[1] = vis[4] = vis[3] = 0;
-          break;
-    case 5:
-          vis[1] = vis[5] = 0;
-          break;
-    case 6:
-          vis[5] = 0;
-          break;
-    case 7:
-          vis[0] = vis[1] = vis[2] = vis[3] = 0;
-          break;
-    case 8:
-          break;
-    case 9:
-          vis[1] = 0;
-  }
-  for(int i = 0;i<7;i++)
-  {
-    if(vis[i] == 1)
-    {
-      Matrices.model = glm::mat4(1.0f);
-      glm::mat4 translateRectangle = glm::translate (glm::vec3(ssx[i], ssy[i], 0));        // glTranslatef
-      glm::mat4 rotateRectangle = glm::rotate((float)(ssa[i]*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)    Matrices.model *= (translateRectangle);
-      Matrices.model *= (translateRectangle * rotateRectangle);
-      MVP = VP * Matrices.model;
-      glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-      draw3DObject(sevenSeg);
-    }
-  }
-  vis[0] = vis[1] = vis[2] = vis[3] = vis[4] = vis[5] = vis[6] = 1;
+void drawPrintScore(const GameState &game, glm::mat4 VP, glm::mat4 MVP)
+{
+  setObjectColor(glm::vec3(0,0,0));
+  glUniform1i(Uniforms.OutlinedID, 0);
+  int first = game.moves % 10;
+  int sec = (game.moves/10) % 100;
+  int firstP = game.lives % 10;
+
+  drawDigit(digitSegments(firstP), -7, VP);
+  drawDigit(digitSegments(first), 0, VP);
+  // No leading zero on the moves
+  drawDigit(sec == 0 ? 0 : digitSegments(sec), -0.5, VP);
+}
 
-  switch(sec)
+// Flat box with its lower left corner at (x,y) on the score's plane
+void drawBar (float x, float y, float w, float h, glm::vec3 color, glm::mat4 VP)
+{
+  setObjectColor(color);
+  Matrices.model = glm::translate(glm::vec3(x + w/2, y + h/2, 0)) * glm::scale(glm::vec3(w, h, 0.01));
+  glm::mat4 MVP = VP * Matrices.model;
+  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+  draw3DObject(cubeMesh);
+}
+
+/* The overlay, right of the score: the average frame time in milliseconds as two digits, the
+   frame time graph with a line at 60 fps, and under it one bar each for GPU and CPU time,
+   split into the block, tile and HUD passes */
+void drawPerfOverlay (glm::mat4 VP)
+{
+  static const glm::vec3 passColor[NUM_PASSES] = {
+    glm::vec3(0.9, 0.6, 0.1), glm::vec3(0.2, 0.6, 0.9), glm::vec3(0.8, 0.2, 0.8)
+  };
+  glUniform1i(Uniforms.OutlinedID, 0);
+
+  float sum = 0;
+  for(int k = 0; k < PERF_HISTORY; k++)
+    sum += perf.frameMs[k];
+  int avg = min(99, (int)(sum/PERF_HISTORY + 0.5f));
+  setObjectColor(glm::vec3(0,0,0));
+  drawDigit(avg >= 10 ? digitSegments(avg/10) : 0, 1.0, VP);
+  drawDigit(digitSegments(avg%10), 1.5, VP);
+
+  // 0.02 per millisecond, clipped at 40 ms, oldest frame on the left
+  const float graphX = 5.5, graphY = 3.15, barW = 0.02, perMs = 0.02;
+  for(int k = 0; k < PERF_HISTORY; k++)
   {
-    case 0:
-          vis[0] = vis[1] = vis[2] = vis[3] = vis[4] = vis[5] = vis[6] = 0;
-          break;
-    case 1:
-          vis[2] = vis[3] = vis[4] = vis[5] = vis[6] = 0;
-          break;
-    case 2:
-          vis[0] = vis[6] = 0;
-          break;
-    case 3:
-          vis[0] = vis[1] = 0;
-          break;
-    case 4:
-          vis[1] = vis[4] = vis[3] = 0;
-          break;
-    case 5:
-          vis[1] = vis[5] = 0;
-          break;
-    case 6:
-          vis[5] = 0;
-          break;
-    case 7:
-          vis[0] = vis[1] = vis[2] = vis[3] = 0;
-          break;
-    case 8:
-          break;
-    case 9:
-          vis[1] = 0;
+    float ms = perf.frameMs[(perf.head + k) % PERF_HISTORY];
+    glm::vec3 color = ms > 1000/60.0f ? glm::vec3(0.9, 0.2, 0.2) : glm::vec3(0.2, 0.8, 0.2);
+    drawBar(graphX + k*barW, graphY, barW, min(ms, 40.0f)*perMs, color, VP);
   }
-  for(int i = 0;i<7;i++)
+  drawBar(graphX, graphY + 1000/60.0f*perMs, PERF_HISTORY*barW, 0.005, glm::vec3(0,0,0), VP);
+
+  // 0.3 per millisecond, GPU on top
+  float gx = graphX, cx = graphX;
+  for(int p = 0; p < NUM_PASSES; p++)
   {
-    if(vis[i] == 1)
-    {
-      Matrices.model = glm::mat4(1.0f);
-      glm::mat4 translateRectangle = glm::translate (glm::vec3(ssx[i] - 0.5, ssy[i], 0));        // glTranslatef
-      glm::mat4 rotateRectangle = glm::rotate((float)(ssa[i]*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)    Matrices.model *= (translateRectangle);
-      Matrices.model *= (translateRectangle * rotateRectangle);
-      MVP = VP * Matrices.model;
-      glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-      draw3DObject(sevenSeg);
-    }
+    float gw = perf.gpuMs[p]*0.3f, cw = perf.cpuShown[p]*0.3f;
+    drawBar(gx, graphY - 0.12, gw, 0.06, passColor[p], VP);
+    drawBar(cx, graphY - 0.22, cw, 0.06, passColor[p], VP);
+    gx += gw;
+    cx += cw;
   }
-  vis[0] = vis[1] = vis[2] = vis[3] = vis[4] = vis[5] = vis[6] = 1;
 }
 
-int checkTile(int b)
+/* Fixed timestep simulation - game rules and animation advance in SIM_DT steps,
+   independent of how often or how regularly frames are drawn */
+const double SIM_DT = 1.0/60.0;
+float simAlpha = 1;   // fraction of a step the renderer is ahead of the last simulated state
+
+/* The roll has been shown - apply what the move did to the scene */
+void finishRoll(Session &s, Block &bl)
 {
-  if(level == 1)
+  int events = endRoll(s.game, bl, floorPos);
+  if(events & EV_WON)
   {
-    if(block[b].state == 1 && p == 1)
-    {
-        if(tileGrid1[ya][x1].type == 0)
-        {
-          if(drop[b] == 1)
-            kill[b] = 1;
-          drop[b] = 1;
-          return 0; 
-        }
-    }
-    else if(p == 1)
-    {
-      if(tileGrid1[ya][x1].type == 0 && tileGrid1[yb][x2].type == 0)
-      {
-        if(drop[b] == 1)
-          kill[b] = 1;
-        drop[b] = 1;
-        return 0; 
-      }
-    }
-    else
-    {
-      if(tileGrid1[ya][x1].type == 0 && b == 0)
-      {
-        if(drop[b] == 1)
-          kill[b] = 1;
-        drop[b] = 1;
-        return 0; 
-      }
-      else if(tileGrid1[yb][x2].type == 0 && b == 1)
-      {
-        if(drop[b] == 1)
-          kill[b] = 1;
-        drop[b] = 1;
-        return 0;
-      }
-    }
-    if(block[b].state == 1 && p == 1)
+    cout << "Congrats you win" << endl;
+    s.over = true;
+    return;
+  }
+  if(events & EV_LEVEL)
+  {
+    s.shownLevel = s.game.level;
+    if(!enterLevel(s, s.shownLevel))
     {
-      if(x1 == goalX && ya == goalY)
-      {
-        level = 2;
-        //Change Special Blocks
-        drop[0] = 0;
-        drop[1] = 0;
-        kill[0] = 0;
-        kill[1] = 0;
-        teleXa = 9;
-        teleYa = 3;
-        teleXb = 1;
-        teleYb = 2;
-
-        goalX = 13;
-        goalY = 3;
-
-        fragX[0] = 14;
-        fragY[0] = 4;
-        //fragX.push_back(7);
-        //fragY.push_back(2);
-        //fragX.push_back(7);
-        //fragY.push_back(4);
-        //fragX.push_back(14);
-        //fragY.push_back(3);
-
-        pathX = 0;
-        pathY = 5;
-
-        bridgeX.clear();
-        bridgeY.clear();
-        bridgeX.push_back(10);
-        bridgeX.push_back(11);
-        //bridgeX.push_back(13);
-        //bridgeX.push_back(14);
-        //bridgeX.push_back(15);
-        //bridgeX.push_back(16);
-        //bridgeX.push_back(16);
-        //bridgeX.push_back(15);
-        bridgeY.push_back(3);
-        bridgeY.push_back(3);
-        //bridgeY.push_back(6);
-        //bridgeY.push_back(6);
-        //bridgeY.push_back(6);
-        //bridgeY.push_back(7);
-        //bridgeY.push_back(7);
-        //bridgeY.push_back(5);
-
-
-        glm::mat4 translateRectangleToAxis = glm::translate(glm::vec3(0,-2.8,-3));        // glTranslatef
-        // glm::mat4 translateRectangleFromAxis = glm::translate(glm::vec3(-tx,-ty,-tz));        // glTranslatef
-        block[0].memoryMat = translateRectangleToAxis;
-        block[0].cx = 0;
-        block[0].cy = -2.8;
-        block[0].cz = -3;
-        // block[1].memoryMat = translateRectangleToAxis;
-        x1 = 7;
-        ya = 3;
-        x2 = 7;
-        yb = 3;
-      }
-      else if(x1 == fragX[0] && ya == fragY[0])
-      {
-        tileGrid1[fragY[0]][fragX[0]].type = 0;
-        if(drop[0] == 1)
-          kill[0] = 1;
-        drop[0] = 1;
-        if(drop[1] == 1)
-          kill[1] = 1;
-        drop[1] = 1;
-        return 0; 
-      }
-      else if(x1 == teleXa && ya == teleYa && done == 0)
-      {
-        done = 1;
-        int x = -8;
-        int z = 1;
-        block[0].cx += x;
-        block[0].cz += z;
-        x1 = teleXb;
-        ya = teleYb;
-        x2 = x1;
-        yb = ya;
-        glm::mat4 translateRectangleToAxis = glm::translate(glm::vec3(block[b].cx,block[b].cy,block[b].cz));        // glTranslatef
-        // glm::mat4 translateRectangleFromAxis = glm::translate(glm::vec3(-tx,-ty,-tz));        // glTranslatef
-        block[b].memoryMat = translateRectangleToAxis; 
-      }
-      else if(x1 == teleXb && ya == teleYb && done == 0)
-      {
-        done = 1;
-        int x = 8;
-        int z = -1;
-        block[0].cx += x;
-        block[0].cz += z;
-        x1 = teleXa;
-        ya = teleYa;
-        x2 = x1;
-        yb = ya;
-        glm::mat4 translateRectangleToAxis = glm::translate(glm::vec3(block[b].cx,block[b].cy,block[b].cz));        // glTranslatef
-        // glm::mat4 translateRectangleFromAxis = glm::translate(glm::vec3(-tx,-ty,-tz));        // glTranslatef
-        block[b].memoryMat = translateRectangleToAxis; 
-      }
+      cout << "Level " << s.shownLevel + 1 << " is broken, see above" << endl;
+      s.over = true;
+      return;
     }
   }
   else
   {
-    if(block[b].state == 1 && p == 1)
-    {
-        if(tileGrid2[ya][x1].type == 0)
-        {
-          if(drop[b] == 1)
-            kill[b] = 1;
-          drop[b] = 1;
-          return 0; 
-        }
-    }
-    else if(p == 1)
-    {
-      if(tileGrid2[ya][x1].type == 0 && tileGrid2[yb][x2].type == 0)
-      {
-        if(drop[b] == 1)
-          kill[b] = 1;
-        drop[b] = 1;
-        return 0; 
-      }
-    }
-    else
+    const Level &lvl = levels[s.game.level];
+    // Only the bridges of the groups under the block changed - standing, both cells are one
+    if(events & EV_SWITCH)
     {
-      if(tileGrid2[ya][x1].type == 0 && b == 0)
-      {
-        if(drop[b] == 1)
-          kill[b] = 1;
-        drop[b] = 1;
-        return 0; 
-      }
-      else if(tileGrid2[yb][x2].type == 0 && b == 1)
-      {
-        if(drop[b] == 1)
-          kill[b] = 1;
-        drop[b] = 1;
-        return 0; 
-      }
-    }
-    if(block[b].state == 1 && p == 1)
-    {
-      if(x1 == goalX && ya == goalY)
-      {
-        cout << "Congrats you win" << endl;
-        exit(0);
-      }
-      // cout << "Hekki" << endl;
-      for(int j = 0;j<fragX.size();j++)
-      {
-        if(x1 == fragX[j] && ya == fragY[j])
-        {
-          tileGrid2[fragY[j]][fragX[j]].type = 0;
-          if(drop[0] == 1)
-            kill[0] = 1;
-          drop[0] = 1;
-          if(drop[1] == 1)
-            kill[1] = 1;
-          drop[1] = 1;
-          return 0; 
-        }
-      }
-      if(x1 == teleXa && ya == teleYa && done == 0)
-      {
-        done = 1;
-        int x = -8;
-        int z = 1;
-        block[0].cx += x;
-        block[0].cz += z;
-        x1 = teleXb;
-        ya = teleYb;
-        x2 = x1;
-        // cout << x1 << " " << ya << "asf"<<endl;
-        yb = ya;
-        glm::mat4 translateRectangleToAxis = glm::translate(glm::vec3(block[b].cx,block[b].cy,block[b].cz));        // glTranslatef
-        // glm::mat4 translateRectangleFromAxis = glm::translate(glm::vec3(-tx,-ty,-tz));        // glTranslatef
-        block[b].memoryMat = translateRectangleToAxis; 
-      }
-      else if(x1 == teleXb && ya == teleYb && done == 0)
-      {
-        done = 1;
-        int x = 8;
-        int z = -1;
-        block[0].cx += x;
-        block[0].cz += z;
-        x1 = teleXa;
-        ya = teleYa;
-        x2 = x1;
-        yb = ya;
-        // cout << x1 << " " << ya << endl;
-
-        glm::mat4 translateRectangleToAxis = glm::translate(glm::vec3(block[b].cx,block[b].cy,block[b].cz));        // glTranslatef
-        // glm::mat4 translateRectangleFromAxis = glm::translate(glm::vec3(-tx,-ty,-tz));        // glTranslatef
-        block[b].memoryMat = translateRectangleToAxis; 
-      }
+      int pressed[2] = {pressedSwitch(s.game, s.game.x1, s.game.y1), pressedSwitch(s.game, s.game.x2, s.game.y2)};
+      if(pressed[1] == pressed[0])
+        pressed[1] = -1;
+      for(int k = 0;k<2;k++)
+        if(pressed[k] >= 0)
+          for(int j = 0;j<(int)lvl.switches[pressed[k]].bridgeX.size();j++)
+            patchTile(s, lvl.switches[pressed[k]].bridgeY[j], lvl.switches[pressed[k]].bridgeX[j]);
     }
+    if(events & EV_FRAGILE)
+      patchTile(s, s.game.y1, s.game.x1);
   }
-  return 1;
 }
 
-void checkTrigger(int b)
+/* Advance block b of a session by one simulation step */
+void updateBlock(Session &s, int b)
 {
-  if(level == 1)
-  {
-    if((x1 == pathX && ya == pathY) || (x2 == pathX && yb == pathY))
-    {
-      for(int i = 0;i<2;i++)
-      {
-          if(tileGrid1[bridgeY[i]][bridgeX[i]].type == 0)
-            tileGrid1[bridgeY[i]][bridgeX[i]].type = 1;
-          else
-            tileGrid1[bridgeY[i]][bridgeX[i]].type = 0;
-      }
-    }
-  }
-  else
+  Block &bl = s.block[b];
+  int tick = animateBlock(bl);
+  if(tick == BLOCK_LANDED)
   {
-    if((x1 == pathX && ya == pathY) || (x2 == pathX && yb == pathY))
-    {
-      for(int i = 0;i<2;i++)
-      {
-          // cout << i << " " << j << endl;
-          if(tileGrid2[bridgeY[i]][bridgeX[i]].type == 0)
-            tileGrid2[bridgeY[i]][bridgeX[i]].type = 1;
-          else
-            tileGrid2[bridgeY[i]][bridgeX[i]].type = 0;
-      }
-    } 
+    cout << "Oops" << endl;
+    bl.falling = false;
+    respawn(s.game);
+    if(s.game.status == GAME_OVER)
+      s.over = true;
+    poseBlock(s.game, bl, floorPos);
   }
+  else if(tick == BLOCK_ROLLED)
+    finishRoll(s, bl);
+  snapBlock(bl);
+}
+
+void simulate(Session &s)
+{
+  if(s.over)
+    return;
+  for(int b = 0;b<(int)s.block.size();b++)
+    updateBlock(s, b);
+}
+
+/* A fresh game on level one with its own tile buffers and camera */
+Session newSession()
+{
+  Session s;
+  s.game = newGame(levels);
+  s.shownLevel = s.game.level;
+  s.camera = initCamera();
+  s.over = false;
+
+  // Level one is uploaded now, the rest streamed in as the game gets to them
+  s.bakedLevel.resize(levels.size());
+  enterLevel(s, s.game.level);
+  glGenQueries(2*NUM_PASSES, &s.passQuery[0][0]);
+
+  s.block.push_back(initBlock(0,-2.8,-3,1,2,1));
+  poseBlock(s.game, s.block[0], floorPos);
+  s.block[0].prevBase = glm::vec3(s.block[0].cx,s.block[0].cy,s.block[0].cz);
+  return s;
 }
 
 /* Render the scene with openGL */
 /* Edit this function according to your assignment */
-void drawBlock(glm::mat4 VP,glm::mat4 MVP, GLFWwindow * window,int doM,int b)
+void drawBlock(glm::mat4 VP,glm::mat4 MVP, GLFWwindow * window,int doM,const Block &bl)
 {
-  // MVP *= prev;
-  if(block[0].move != 0 && done == 1)
-    done = 0;
-  if(block[b].move == 0)
-    checkTile(b);
-  // checkTrigger(b);
-  if(kill[b] == 1)
-  {
-    if(block[b].cy > -12)
-    {
-      // cout << block[0].cy << endl;
-      block[b].cy -= 0.2;
-      glm::mat4 translateRectangleToAxis = glm::translate(glm::vec3(block[b].cx,block[b].cy,block[b].cz));        // glTranslatef
-      // glm::mat4 translateRectangleFromAxis = glm::translate(glm::vec3(-tx,-ty,-tz));        // glTranslatef
-      block[b].memoryMat = translateRectangleToAxis; 
-    }
-    else
-    {
-      drop[0] = 0;
-        drop[1] = 0;
-        kill[0] = 0;
-        kill[1] = 0;
-      cout << "Oops" << endl;
-      score = 0;
-      lives--;
-      glm::mat4 translateRectangleToAxis = glm::translate(glm::vec3(0,-2.8,-3));        // glTranslatef
-        // glm::mat4 translateRectangleFromAxis = glm::translate(glm::vec3(-tx,-ty,-tz));        // glTranslatef
-        block[0].memoryMat = translateRectangleToAxis;
-        block[0].cx = 0;
-        block[0].cy = -2.8;
-        block[0].cz = -3;
-        block[0].state = 1;
-        block[0].sx = 1;
-        block[0].sy = 2;
-        block[0].sz = 1;
-        // block[1].memoryMat = translateRectangleToAxis;
-        x1 = 7;
-        ya = 3;
-        x2 = 7;
-        yb = 3;
-      if(lives == -1)
-        exit(0);
-    }
-  }
-  else if(block[b].move == 1)
-  {
-    if(block[b].tempAngle != block[b].angle)
-    {
-      if(block[b].angle < 0)
-      {
-        block[b].tempAngle -= 1 * block[b].speed;
-      }
-      else
-      {
-        block[b].tempAngle += 1 * block[b].speed;
-      }
-    }
-    else
-    {
-      if(p == 1)
-      {
-        if(block[b].state == 1)
-        {
-          block[b].sx = 1;
-          block[b].sy = 2;
-          block[b].sz = 1;
-        }
-        if(block[b].state == 2)
-        {
-          block[b].sx = 2;
-          block[b].sy = 1;
-          block[b].sz = 1;
-        }
-        if(block[b].state == 3)
-        {
-          block[b].sx = 1;
-          block[b].sy = 1;
-          block[b].sz = 2;
-        }
-      }
-      else
-      {
-        block[b].sx = 1;
-        block[b].sy = 1;
-        block[b].sz = 1;
-      }
-      glm::mat4 translateRectangleToAxis = glm::translate(glm::vec3(block[b].cx,block[b].cy,block[b].cz));        // glTranslatef
-      block[b].memoryMat = translateRectangleToAxis; 
-      block[b].x = block[b].y = block[b].z = 0;
-      block[b].angle = block[b].tempAngle = 0;
-      block[b].move = 0;
-      block[b].tx = block[b].ty = block[b].tz = 0;
-      divY = 1;
-      divX = 1;
-      divZ = 1;
-      checkTrigger(b);
-      // cout << x1 << " " << ya << " " << x2 << " " << yb << endl;
-      // ch = 0;
-    }
-  }
-  else if(block[b].move == -1)
-  {
-    if(block[b].tempAngle != block[b].angle)
-    {
-      if(block[b].angle < 0)
-      {
-        block[b].tempAngle -= 1 * block[b].speed;
-      }
-      else
-      {
-        block[b].tempAngle += 1 * block[b].speed;
-      }
-    }
-    else
-    {
-      if(p == 1)
-      {
-        if(block[b].state == 1)
-        {
-          block[b].sx = 1;
-          block[b].sy = 2;
-          block[b].sz = 1;
-        }
-        if(block[b].state == 2)
-        {
-          block[b].sx = 2;
-          block[b].sy = 1;
-          block[b].sz = 1;
-        }
-        if(block[b].state == 3)
-        {
-          block[b].sx = 1;
-          block[b].sy = 1;
-          block[b].sz = 2;
-        }
-      }
-      else
-      {
-        block[b].sx = 1;
-        block[b].sy = 1;
-        block[b].sz = 1;
-      }
-      glm::mat4 translateRectangleToAxis = glm::translate(glm::vec3(block[b].cx,block[b].cy,block[b].cz));        // glTranslatef
-      // glm::mat4 translateRectangleFromAxis = glm::translate(glm::vec3(-tx,-ty,-tz));        // glTranslatef
-      block[b].memoryMat = translateRectangleToAxis; 
-      
-      block[b].angle = block[b].tempAngle = 0;
-      block[b].x = block[b].y = block[b].z = 0;
-      block[b].tx = block[b].ty = block[b].tz = 0;
-      block[b].move = 0;
-      divY = 1;
-      divX = 1;
-      divZ = 1;
-      checkTrigger(b);
-      // cout << x1 << " " << ya << " " << x2 << " " << yb << endl;
-    }
-    
-  }
-  else
-  {
-    block[b].tx = block[b].ty = block[b].tz = 0;
-    block[b].x = 0;
-    block[b].z = 0;
-    block[b].y = 1;
-  }
-  if(splitz == 1)
-  {
-    for(int i = 0;i<p;i++)
-    {
-      block[i].sx = block[i].sy = block[i].sz = 1;
-    }  
-  }
-  Matrices.model = block[b].memoryMat;
-  glm::mat4 scaleCube = glm::scale(glm::vec3(block[b].sx,block[b].sy,block[b].sz));
-  if(block[b].tempAngle != 0)
+  // The roll itself is evaluated in the vertex shader (drawMode 2) - the CPU only hands over
+  // the resting position, the pivot edge, the axis and the current angle
+  // Interpolate between the last two simulated states
+  glm::vec3 base = glm::vec3(bl.memoryMat[3][0], bl.memoryMat[3][1], bl.memoryMat[3][2]);
+  base = glm::mix(bl.prevBase, base, simAlpha);
+  float angle = glm::mix((float)bl.prevAngle, (float)bl.tempAngle, simAlpha);
+
+  MVP = VP;
+  if(doM)
   {
-      if(p == 2)
-      {
-        divX = divY = divZ = 1;
-      }
-      block[b].tx = float(X1[i]/divX);
-      block[b].ty = float(Y1[i]/divY);
-      block[b].tz = float(Z1[i]/divZ);
-      glm::mat4 translateRectangleToAxis = glm::translate(glm::vec3(block[b].tx,block[b].ty,block[b].tz));        // glTranslatef
-      glm::mat4 rotateRectangle = glm::rotate((float)(block[b].tempAngle*M_PI/180.0f), glm::vec3(block[b].x,block[b].y,block[b].z));
-      glm::mat4 translateRectangleFromAxis = glm::translate(glm::vec3(-block[b].tx,-block[b].ty,-block[b].tz));        // glTranslatef
-      Matrices.model *= translateRectangleToAxis * rotateRectangle * translateRectangleFromAxis;
-      // memoryMat = Matrices.model;
+    glm::vec3 offset = floor_rel ? floor_pos : glm::vec3(0,0,0);
+    glUniform1i(Uniforms.DrawModeID, 2);
+    glUniform3f(Uniforms.BlockBaseID, base.x, base.y, base.z);
+    glUniform3f(Uniforms.BlockScaleID, bl.sx, bl.sy, bl.sz);
+    glUniform3f(Uniforms.BlockOffsetID, offset.x, offset.y, offset.z);
+    glUniform3f(Uniforms.RollPivotID, bl.tx, bl.ty, bl.tz);
+    glUniform3f(Uniforms.RollAxisID, bl.x, bl.y, bl.z);
+    glUniform1f(Uniforms.RollAngleID, angle);
   }
-  // glm::mat4 translateRectangle = glm::translate(glm::vec3(0,-1,0));        // glTranslate
-  Matrices.model *= scaleCube;
-
-  if(floor_rel)
-    Matrices.model = Matrices.model * glm::translate(floor_pos);
-  if(doM)
-    MVP *= VP * Matrices.model;
-  else
-    MVP *= VP;
-  if(drop[b] == 1)
-    kill[b] = 1;
 
   // prev *= MVP;
   glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
     // draw3DObject draws the VAO given to it using current MVP matrix
   // draw3DObject(rectangle);
-  currColor = 5;
-  createRectangle();
-  draw3DObject(rectangle);
-  createRectangleBorder();
-  draw3DObject(rectangle);
+  setObjectColor(tileColor[5]);
+  glUniform1i(Uniforms.OutlinedID, 1);
+  draw3DObject(cubeMesh);
+  glUniform1i(Uniforms.DrawModeID, 0);
 }
 
-void draw (GLFWwindow* window, float x, float y, float w, float h, int doM, int doV, int doP)
+void draw (GLFWwindow* window, const Session &s, float x, float y, float w, float h, int doM, int doV, int doP)
 {
+    TRACE_SCOPE("draw");
     int fbwidth, fbheight;
     glfwGetFramebufferSize(window, &fbwidth, &fbheight);
     glViewport((int)(x*fbwidth), (int)(y*fbheight), (int)(w*fbwidth), (int)(h*fbheight));
+    // Sessions side by side each get a slice of the window, keep their aspect right
+    Matrices.projection = glm::perspective(fov, (w*fbwidth)/(h*fbheight), 0.1f, farPlane);
+    const Camera &cam = s.camera;
 
 
     // use the loaded shader program
@@ -1979,10 +1294,10 @@ void draw (GLFWwindow* window, float x, float y, float w, float h, int doM, int
     // Target - Where is the camera looking at.  Don't change unless you are sure!!
     
     glm::vec3 target = glm::vec3(0.0f, 0.0f, 0.0f);
-    glm::vec3 cameraDirection = glm::normalize(eye - target);
+    glm::vec3 cameraDirection = glm::normalize(cam.eye - target);
     // Up - Up vector defines tilt of camera.  Don't change unless you are sure!!
    
-    glm::vec3 cameraRight = glm::normalize(glm::cross(up, cameraDirection));
+    glm::vec3 cameraRight = glm::normalize(glm::cross(cam.up, cameraDirection));
 
     glm::vec3 cameraUp = glm::cross(cameraDirection, cameraRight);
 
@@ -1991,7 +1306,7 @@ void draw (GLFWwindow* window, float x, float y, float w, float h, int doM, int
     GLfloat camX = sin(glfwGetTime()) * radius;
     GLfloat camZ = cos(glfwGetTime()) * radius;
     glm::mat4 view;
-    view = glm::lookAt(eye, eye + front, up); 
+    view = glm::lookAt(cam.eye, cam.eye + cam.front, cam.up); 
     Matrices.view = view; 
 
     // Compute Camera matrix (view)
@@ -2021,50 +1336,43 @@ void draw (GLFWwindow* window, float x, float y, float w, float h, int doM, int
     // MVP = VP * Matrices.model;
     // glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
     // draw3DObject(rectangle);
-    for(int i = 0;i<p;i++)
-      drawBlock(VP,MVP,window,doM,i);
+    {
+      TRACE_SCOPE("drawBlock");
+      perfBegin(s, PASS_BLOCK);
+      for(int i = 0;i<(int)s.block.size();i++)
+        drawBlock(VP,MVP,window,doM,s.block[i]);
+      perfEnd(PASS_BLOCK);
+    }
+
 
-    // cout << "Hello" << endl;
-    for(int j = 0 ; j<floorHeight ; j++)
     {
-      for(int i = 0 ; i<floorWidth ; i++)
-      {
-        if(level == 1)
-        {
-          if(tileGrid1[j][i].type != 0)
-          {
-          Matrices.model = genModelMatrix(tileGrid1[j][i].T, floorRot , glm::vec3(1,0.5,1));
-          MVP = VP * Matrices.model;
-          glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-          currColor = tileGrid1[j][i].type;
-          createRectangle();
-          draw3DObject(rectangle);
-          createRectangleBorder();
-          draw3DObject(rectangle);
-          }
-        }
-        else
-        {
-          if(tileGrid2[j][i].type != 0)
-          {
-          Matrices.model = genModelMatrix(tileGrid2[j][i].T, floorRot , glm::vec3(1,0.5,1));
-          MVP = VP * Matrices.model;
-          glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-          currColor = tileGrid2[j][i].type;
-          createRectangle();
-          draw3DObject(rectangle);
-          createRectangleBorder();
-          draw3DObject(rectangle);
-          }
-        }
-      }
+      TRACE_SCOPE("tiles");
+      perfBegin(s, PASS_TILES);
+      // Whole tile grid, outlines included, in one instanced draw from the baked level buffer
+      glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &VP[0][0]);
+      glUniform1i(Uniforms.DrawModeID, 1);
+      glUniform1i(Uniforms.ColorModeID, 2);
+      glUniform1i(Uniforms.OutlinedID, 1);
+      draw3DObjectInstanced(s.bakedLevel[s.shownLevel].Mesh, s.bakedLevel[s.shownLevel].NumInstances);
+      glUniform1i(Uniforms.DrawModeID, 0);
+      perfEnd(PASS_TILES);
     }
-    drawPrintScore(VP,MVP);
+
+    {
+      TRACE_SCOPE("drawPrintScore");
+      perfBegin(s, PASS_HUD);
+      drawPrintScore(s.game,VP,MVP);
+      perfEnd(PASS_HUD);
+    }
+
+    if(perf.shown)
+      drawPerfOverlay(VP);
 }
 
 /* Initialise glfw window, I/O callbacks and the renderer to use */
 /* Nothing to Edit here */
 GLFWwindow* initGLFW (int width, int height){
+    TRACE_SCOPE("initGLFW");
     GLFWwindow* window; // window desciptor/handle
 
     glfwSetErrorCallback(error_callback);
@@ -2104,17 +1412,35 @@ GLFWwindow* initGLFW (int width, int height){
 /* Add all the models to be created here */
 void initGL (GLFWwindow* window, int width, int height)
 {
+    TRACE_SCOPE("initGL");
     /* Objects should be created before any other gl function and shaders */
     // Create the models
-    createRectangle ();
+    createCube ();
     createCam();
     createFloor();
-    createSevenSeg();
 	
     // Create and compile our GLSL program from the shaders
     programID = LoadShaders( "Sample_GL.vert", "Sample_GL.frag" );
     // Get a handle for our "MVP" uniform
     Matrices.MatrixID = glGetUniformLocation(programID, "MVP");
+    Uniforms.DrawModeID = glGetUniformLocation(programID, "drawMode");
+    Uniforms.TileScaleID = glGetUniformLocation(programID, "tileScale");
+    Uniforms.TileColorsID = glGetUniformLocation(programID, "tileColors");
+    Uniforms.ColorModeID = glGetUniformLocation(programID, "colorMode");
+    Uniforms.ObjectColorID = glGetUniformLocation(programID, "objectColor");
+    Uniforms.OutlinedID = glGetUniformLocation(programID, "outlined");
+    Uniforms.BlockBaseID = glGetUniformLocation(programID, "blockBase");
+    Uniforms.BlockScaleID = glGetUniformLocation(programID, "blockScale");
+    Uniforms.BlockOffsetID = glGetUniformLocation(programID, "blockOffset");
+    Uniforms.RollPivotID = glGetUniformLocation(programID, "rollPivot");
+    Uniforms.RollAxisID = glGetUniformLocation(programID, "rollAxis");
+    Uniforms.RollAngleID = glGetUniformLocation(programID, "rollAngle");
+
+    glUseProgram (programID);
+    glUniform3fv(Uniforms.TileColorsID, NUM_TILE_TYPES, &tileColor[0][0]);
+    glUniform1i(Uniforms.ColorModeID, 0);
+    glUniform3f(Uniforms.TileScaleID, 1, 0.5, 1);
+    glUniform1i(Uniforms.DrawModeID, 0);
 
 	
     reshapeWindow (window, width, height);
@@ -2132,6 +1458,107 @@ void initGL (GLFWwindow* window, int width, int height)
     cout << "GLSL: " << glGetString(GL_SHADING_LANGUAGE_VERSION) << endl;
 }
 
+/* --bench N : time N frames of a fixed camera orbit over one level while a scripted move
+   sequence plays on it, then print frame-time statistics as JSON. Vsync is off and the first
+   BENCH_WARMUP frames (shader compiles, first uploads) are not counted, so builds and
+   machines are compared on the same work. */
+#define BENCH_WARMUP 60
+struct Bench {
+    int frames;                   // frames to time, 0 when not benchmarking
+    string moves;                 // L, R, U, D - replayed from the start whenever the game restarts
+    int nextMove;
+    int drawn;                    // frames drawn so far, warmup included
+    double lastTime;
+    vector<double> frameMs;
+};
+Bench bench;
+
+// Camera for frame n of the orbit - one full turn around the level over the timed frames
+void benchCamera (Session &s, int n)
+{
+    const Level &lvl = levels[s.shownLevel];
+    glm::vec3 centre = tilePosition(lvl.height/2, lvl.width/2);
+    float radius = max(lvl.width, lvl.height)*0.75f + 3;
+    float a = 2*M_PI*n/(BENCH_WARMUP + bench.frames);
+    s.camera.eye = centre + glm::vec3(radius*cos(a), radius*0.6f, radius*sin(a));
+    s.camera.front = glm::normalize(centre - s.camera.eye);
+    s.camera.up = glm::vec3(0, 1, 0);
+}
+
+// Start s over on level one, keeping its tile buffers
+void restartSession (Session &s)
+{
+    s.game = newGame(levels, 1 << 30);
+    s.shownLevel = s.game.level;
+    s.over = false;
+    bakeLevel(s, s.game.level);
+    s.block[0] = initBlock(0,-2.8,-3,1,2,1);
+    poseBlock(s.game, s.block[0], floorPos);
+    s.block[0].prevBase = glm::vec3(s.block[0].cx,s.block[0].cy,s.block[0].cz);
+}
+
+// Feed the next scripted move once the block is free to take one
+void benchInput (Session &s)
+{
+    if(s.over)
+    {
+      restartSession(s);
+      bench.nextMove = 0;
+    }
+    const Block &bl = s.block[0];
+    if(bl.move != 0 || bl.falling || s.game.status != PLAYING)
+      return;
+    char c = bench.moves[bench.nextMove];
+    bench.nextMove = (bench.nextMove + 1) % bench.moves.size();
+    startRoll(s, c == 'L' ? MOVE_LEFT : c == 'R' ? MOVE_RIGHT : c == 'U' ? MOVE_UP : MOVE_DOWN);
+}
+
+// Nearest-rank percentile of sorted frame times
+double percentile (const vector<double> &sorted, double p)
+{
+    int rank = (int)ceil(p/100*sorted.size());
+    return sorted[max(rank, 1) - 1];
+}
+
+// s as a JSON string literal - level names come from level files and may hold anything
+void jsonString (FILE *out, const char *s)
+{
+    fputc('"', out);
+    for(; *s; s++)
+      if(*s == '"' || *s == '\\')
+        fprintf(out, "\\%c", *s);
+      else if((unsigned char)*s < 0x20)
+        fprintf(out, "\\u%04x", (unsigned char)*s);
+      else
+        fputc(*s, out);
+    fputc('"', out);
+}
+
+void benchReport (FILE *out)
+{
+    vector<double> sorted = bench.frameMs;
+    sort(sorted.begin(), sorted.end());
+    double total = 0;
+    for(int n = 0; n < (int)sorted.size(); n++)
+      total += sorted[n];
+    const Level &lvl = levels[0];
+    fprintf(out, "{\n");
+    fprintf(out, "  \"level\": ");
+    jsonString(out, lvl.name.c_str());
+    fprintf(out, ",\n");
+    fprintf(out, "  \"width\": %d,\n  \"height\": %d,\n", lvl.width, lvl.height);
+    fprintf(out, "  \"sessions\": %d,\n", (int)sessions.size());
+    fprintf(out, "  \"renderer\": ");
+    jsonString(out, (const char*)glGetString(GL_RENDERER));
+    fprintf(out, ",\n");
+    fprintf(out, "  \"frames\": %d,\n", (int)sorted.size());
+    fprintf(out, "  \"frames_requested\": %d,\n", bench.frames);
+    fprintf(out, "  \"avg_fps\": %.2f,\n", sorted.size()*1000.0/total);
+    fprintf(out, "  \"frame_ms\": {\"avg\": %.3f, \"p50\": %.3f, \"p95\": %.3f, \"p99\": %.3f, \"max\": %.3f}\n",
+            total/sorted.size(), percentile(sorted, 50), percentile(sorted, 95), percentile(sorted, 99), sorted.back());
+    fprintf(out, "}\n");
+}
+
 int main (int argc, char** argv)
 {
     int width = 1366;
@@ -2144,141 +1571,237 @@ int main (int argc, char** argv)
     floorPos = glm::vec3(-7, -4, 0);
     floor_pos = glm::vec3(0, 0, 0);
 
-    //Audio
-     mpg123_handle *mh;
-    unsigned char *buffer;
-    size_t buffer_size;
-    size_t done;
-    int err;
-
-    int driver;
-    ao_device *dev;
-
-    ao_sample_format format;
-    int channels, encoding;
-    long rate;
-
-//    if(argc < 2)
-  //      exit(0);
-
-    /* initializations */
-    ao_initialize();
-    driver = ao_default_driver_id();
-    mpg123_init();
-    mh = mpg123_new(NULL, &err);
-    buffer_size = 3000;
-    buffer = (unsigned char*) malloc(buffer_size * sizeof(unsigned char));
-
-    /* open the file and get the decoding format */
-    mpg123_open(mh, "mario.mp3");
-    mpg123_getformat(mh, &rate, &channels, &encoding);
-
-    // /* set the output format and open the output device */
-    format.bits = mpg123_encsize(encoding) * BITS;
-    format.rate = rate;
-    format.channels = channels;
-    format.byte_format = AO_FMT_NATIVE;
-    format.matrix = 0;
-    dev = ao_open_live(driver, &format, NULL);
-
-    GLFWwindow* window = initGLFW(width, height);
-    // initGLEW();
-    initGL (window, width, height);
-
-    last_update_time = glfwGetTime();
+    // --pcm-cache : decode the music once into a cache file next to the binary and
+    // stream it memory-mapped from then on, instead of decoding it while playing
+    string exeDir = ".";
+    bool pcmCache = false;
+    // --instances N : N independent games side by side, Tab moves the keyboard between them
+    int numSessions = 1;
+    // --levels PATH : a level pack, or one level's .txt file, instead of levels.blxp next to the binary
+    string levelPath;
+    // --solve : print the shortest solution of every level and exit
+    bool solveOnly = false;
+    // --bench N [--bench-level L | --bench-stress SIZE] [--bench-out FILE] : see Bench
+    bench.frames = 0;
+    int benchLevel = 1, benchStress = 0;
+    string benchOut;
+    // --trace FILE : record startup and every frame's phases as Chrome trace JSON, see Trace.h
+    string tracePath;
+    for(int a = 1; a < argc; a++)
+      if(string(argv[a]) == "--solve")
+        solveOnly = true;
+      else if(string(argv[a]) == "--trace" && a + 1 < argc)
+        tracePath = argv[++a];
+      else if(string(argv[a]) == "--bench" && a + 1 < argc)
+        bench.frames = max(1, atoi(argv[++a]));
+      else if(string(argv[a]) == "--bench-level" && a + 1 < argc)
+        benchLevel = atoi(argv[++a]);
+      else if(string(argv[a]) == "--bench-stress" && a + 1 < argc)
+        benchStress = max(4, atoi(argv[++a]));
+      else if(string(argv[a]) == "--bench-out" && a + 1 < argc)
+        benchOut = argv[++a];
+      else if(string(argv[a]) == "--levels" && a + 1 < argc)
+        levelPath = argv[++a];
+      else if(string(argv[a]) == "--pcm-cache")
+        pcmCache = true;
+      else if(string(argv[a]) == "--instances" && a + 1 < argc)
+        numSessions = max(1, atoi(argv[++a]));
+    if(strrchr(argv[0], '/'))
+      exeDir = string(argv[0], strrchr(argv[0], '/') - argv[0]);
+    if(!tracePath.empty() && traceStart(tracePath.c_str()))
+      traceThreadName("main");
 
     //Level Design
-    for(int i = 0; i < floorHeight; i++)
+    if(levelPath.empty())
+      levelPath = exeDir + "/levels.blxp";
     {
-      vector<tile> tempRow;
-      for(int j = 0; j <floorWidth; j++)
+      TRACE_SCOPE("loadLevels");
+      if(!loadLevels(levelPath.c_str(), levels, levelPack) || levels.empty())
       {
-        tile tempTile;
-        tempTile.type = lvlone[i][j];
-        tempTile.T = floorPos + glm::vec3(j,0,-i);
-        tempTile.S = glm::vec3(1,0.5,1);
-        tempRow.push_back(tempTile);
+        cerr << "No levels loaded from " << levelPath << " - build the pack with 'make levels.blxp'" << endl;
+        return 1;
       }
-      tileGrid1.push_back(tempRow);
     }
-
-    for(int i = 0; i < floorHeight; i++)
+    if(solveOnly)
     {
-      vector<tile> tempRow;
-      for(int j = 0; j <floorWidth; j++)
+      for(int l = 0; l < (int)levels.size(); l++)
+        compileLevel(levels, l);
+      for(int l = 0; l < (int)levels.size(); l++)
       {
-        tile tempTile;
-        tempTile.type = lvltwo[i][j];
-        tempTile.T = floorPos + glm::vec3(j,0,-i);
-        tempTile.S = glm::vec3(1,0.5,1);
-        tempRow.push_back(tempTile);
+        Solution sol = solveLevel(levels, l);
+        cout << "Level " << l + 1 << ": ";
+        if(!sol.supported)
+        {
+          cout << "unsupported, more than " << SOLVER_MAX_SWITCHES << " switch groups" << endl;
+          continue;
+        }
+        if(sol.solved)
+          cout << sol.moves << " (" << sol.moves.size() << " moves";
+        else
+          cout << "no solution (";
+        cout << ", " << sol.expanded << " states expanded)" << endl;
       }
-      tileGrid2.push_back(tempRow);
+      return 0;
     }
 
-    //bridgeY.push_back(3);
-    bridgeY.push_back(4);
-    bridgeY.push_back(4);
-    //bridgeX.push_back(10);
-    bridgeX.push_back(12);
-    bridgeX.push_back(13);
-
-    pathY = 4;
-    pathX = 8;
+    if(bench.frames)
+    {
+      // One level, played by the solver's moves when it has a solution
+      if(benchStress)
+        levels.assign(1, generateLevel(benchStress, benchStress, 12345));
+      else
+      {
+        if(benchLevel < 1 || benchLevel > (int)levels.size())
+        {
+          cerr << "--bench-level must be 1 to " << levels.size() << endl;
+          return 1;
+        }
+        Level chosen = levels[benchLevel - 1];
+        levels.assign(1, chosen);
+      }
+      Solution sol = solveLevel(levels, 0);
+      bench.moves = sol.solved ? sol.moves : "RRLLUUDD";
+      bench.nextMove = bench.drawn = 0;
+      farPlane = max(100.0f, 3.0f*max(levels[0].width, levels[0].height));
+    }
+    else
+    {
+      // Music is decoded and played on its own threads from here on
+      TRACE_SCOPE("audioStart");
+      audioStart("mario.mp3", pcmCache ? exeDir.c_str() : NULL);
+    }
 
-    fragY.push_back(3);
-    fragX.push_back(10);
+    GLFWwindow* window = initGLFW(width, height);
+    // initGLEW();
+    initGL (window, width, height);
+    if(bench.frames)
+      glfwSwapInterval(0);
 
-    goalX = 15;
-    goalY = 6;
+    last_update_time = glfwGetTime();
 
+    // The first level is checked and drawn before any game starts on it, its graph and the
+    // rest of the levels come from the worker while playing
+    graphInstalled.assign(levels.size(), 0);
+    tilesChecked.assign(levels.size(), 0);
+    levelStreamStart(levels);
+    levelStreamRequest(0);
+    {
+      TRACE_SCOPE("first level");
+      if(!levelTilesOk(0))
+      {
+        cerr << "Level 1 of " << levelPath << " is broken" << endl;
+        return 1;
+      }
+      for(int n = 0; n < numSessions; n++)
+      {
+        sessions.push_back(newSession());
+        if(bench.frames)
+          sessions[n].game.lives = 1 << 30;
+      }
+    }
 
-    block.push_back(initBlock(0,-2.8,-3,1,2,1));
-    glm::mat4 translateRectangleToAxis = glm::translate(glm::vec3(block[0].cx,block[0].cy,block[0].cz));        // glTranslatef
-    block[0].memoryMat = translateRectangleToAxis; 
+    double accumulator = 0;
+    lastFrame = glfwGetTime();
 
     /* Draw in loop */
     while (!glfwWindowShouldClose(window)) {
-    
-         if (mpg123_read(mh, buffer, buffer_size, &done) == MPG123_OK)
-            ao_play(dev, (char *)buffer, done);
-        else 
-            mpg123_seek(mh, 0, SEEK_SET); // loop audio from start again if ended
-
+        TRACE_SCOPE("frame");
 
 	// clear the color and depth in the frame buffer
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	{
+	  TRACE_SCOPE("glClear");
+	  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	}
 
         // OpenGL Draw commands
 	current_time = glfwGetTime();
 
+        if(bench.frames)
+        {
+          if(bench.drawn > BENCH_WARMUP)
+            bench.frameMs.push_back((current_time - bench.lastTime)*1000);
+          if((int)bench.frameMs.size() == bench.frames)
+            break;
+          bench.lastTime = current_time;
+          for(int n = 0; n < (int)sessions.size(); n++)
+          {
+            benchInput(sessions[n]);
+            benchCamera(sessions[n], bench.drawn);
+          }
+          bench.drawn++;
+        }
+
 	if(do_rot)
 	    camera_rotation_angle += 90*(current_time - last_update_time); // Simulating camera rotation
 	if(camera_rotation_angle > 720)
 	    camera_rotation_angle -= 720;
 	last_update_time = current_time;
-     
 
-	draw(window, 0, 0, 1, 1, 1, 1, 1);
+        // Run as many fixed simulation steps as real time has passed, then draw in between them
+        currentFrame = current_time;
+        deltaTime = currentFrame - lastFrame;
+        lastFrame = currentFrame;
+        accumulator += min(deltaTime, 0.25f); // don't try to catch up after a long stall
+        while(accumulator >= SIM_DT)
+        {
+          TRACE_SCOPE("simulate");
+          for(int n = 0; n < (int)sessions.size(); n++)
+            simulate(sessions[n]);
+          accumulator -= SIM_DT;
+        }
+        simAlpha = accumulator / SIM_DT;
+        perfFrameStart();
+        {
+          TRACE_SCOPE("streamLevels");
+          streamLevels();
+        }
+
+        // Side by side, one vertical slice of the window per session
+        int running = 0;
+        for(int n = 0; n < (int)sessions.size(); n++)
+        {
+          draw(window, sessions[n], (float)n/sessions.size(), 0, 1.0f/sessions.size(), 1, 1, 1, 1);
+          running += !sessions[n].over;
+        }
+        // A bench restarts finished games itself, in benchInput
+        if(running == 0 && !bench.frames)
+          break;
+        perfFrameEnd(deltaTime*1000);
     
 
         // Swap Frame Buffer in double buffering
-        glfwSwapBuffers(window);
+        {
+          TRACE_SCOPE("glfwSwapBuffers");
+          glfwSwapBuffers(window);
+        }
 
         // Poll for Keyboard and mouse events
-        glfwPollEvents();
-        
-        deltaTime = currentFrame - lastFrame;
-        lastFrame = currentFrame;    
+        {
+          TRACE_SCOPE("glfwPollEvents");
+          glfwPollEvents();
+        }
+
         do_movement ();
     }
 
-    free(buffer);
-    ao_close(dev);
-    mpg123_close(mh);
-    mpg123_delete(mh);
-    mpg123_exit();
-    ao_shutdown();
+    if(bench.frames && (int)bench.frameMs.size() < bench.frames)
+      cerr << "--bench: only " << bench.frameMs.size() << " of " << bench.frames << " frames timed" << endl;
+    if(bench.frames && !bench.frameMs.empty())
+    {
+      FILE *out = benchOut.empty() ? stdout : fopen(benchOut.c_str(), "w");
+      if(out == NULL)
+        cerr << "Cannot write " << benchOut << endl;
+      else
+      {
+        benchReport(out);
+        if(out != stdout)
+          fclose(out);
+      }
+    }
+
+    levelStreamStop();
+    audioStop();
+    traceStop();
 
     glfwTerminate();
     return 0;
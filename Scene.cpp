@@ -0,0 +1,184 @@
+#include <cmath>
+
+#include <glm/gtx/transform.hpp>
+
+#include "Scene.h"
+
+// Pivot edge of a standing 1x1x1 cube for each roll, indexed by Block pivot - see beginRoll()
+static const float X1[4] = {-0.5,0,0,0.5};
+static const float Y1[4] = {-0.5,-0.5,-0.5,-0.5};
+static const float Z1[4] = {0,0.5,-0.5,0};
+
+Block initBlock (float cx, float cy, float cz, int sx, int sy, int sz)
+{
+    Block bloc;
+    bloc.move = 0;
+    bloc.angle = 0;
+    bloc.tempAngle = 0;
+    bloc.prevAngle = 0;
+    bloc.prevBase = glm::vec3(cx,cy,cz);
+    bloc.x = bloc.y = bloc.z = 0;
+    bloc.state = 1;
+    bloc.speed = 11;
+    bloc.tx = bloc.ty = bloc.tz = 0;
+    bloc.events = 0;
+    bloc.falling = false;
+    bloc.cx = cx;
+    bloc.cy = cy;
+    bloc.cz = cz;
+    bloc.sx = sx;
+    bloc.sz = sz;
+    bloc.sy = sy;
+    return bloc;
+}
+
+// The floor's top is at y = -3.75
+void poseBlock (const GameState& game, Block& bl, glm::vec3 origin)
+{
+    bl.state = game.orientation;
+    bl.sx = bl.sy = bl.sz = 1;
+    bl.cx = origin.x + (game.x1 + game.x2) / 2.0f;
+    bl.cz = origin.z - (game.y1 + game.y2) / 2.0f;
+    if(game.orientation == STANDING)
+    {
+      bl.sy = 2;
+      bl.cy = -2.8;
+    }
+    else
+    {
+      bl.cy = -3.3;
+      if(game.orientation == LYING_X)
+        bl.sx = 2;
+      else
+        bl.sz = 2;
+    }
+    bl.memoryMat = glm::translate(glm::vec3(bl.cx,bl.cy,bl.cz));        // glTranslatef
+}
+
+void beginRoll (Block& bl, Move m, int events)
+{
+    static const int pivot[NUM_MOVES] = {0, 3, 2, 1};
+    static const int rollAngle[NUM_MOVES] = {88, -88, -88, 88};
+    bl.move = 1;
+    bl.angle = rollAngle[m];
+    bl.x = (m == MOVE_UP || m == MOVE_DOWN);
+    bl.y = 0;
+    bl.z = !bl.x;
+    // The pivot tables describe a 1x1x1 cube, stretch them over a lying or standing block
+    bl.tx = X1[pivot[m]] * bl.sx;
+    bl.ty = Y1[pivot[m]] * bl.sy;
+    bl.tz = Z1[pivot[m]] * bl.sz;
+    bl.events = events;
+}
+
+int animateBlock (Block& bl)
+{
+    bl.prevAngle = bl.tempAngle;
+    bl.prevBase = glm::vec3(bl.memoryMat[3][0], bl.memoryMat[3][1], bl.memoryMat[3][2]);
+
+    if(bl.falling)
+    {
+      if(bl.cy <= -12)
+        return BLOCK_LANDED;
+      bl.cy -= 0.2;
+      bl.memoryMat = glm::translate(glm::vec3(bl.cx,bl.cy,bl.cz));        // glTranslatef
+    }
+    else if(bl.move != 0)
+    {
+      if(bl.tempAngle == bl.angle)
+        return BLOCK_ROLLED;
+      bl.tempAngle += bl.angle < 0 ? -bl.speed : bl.speed;
+    }
+    return BLOCK_MOVING;
+}
+
+int endRoll (const GameState& game, Block& bl, glm::vec3 origin)
+{
+    int events = bl.events;
+    bl.move = 0;
+    bl.angle = bl.tempAngle = 0;
+    bl.x = bl.y = bl.z = 0;
+    bl.tx = bl.ty = bl.tz = 0;
+    bl.events = 0;
+    poseBlock(game, bl, origin);
+    bl.falling = (events & EV_FELL) != 0;
+    return events;
+}
+
+void snapBlock (Block& bl)
+{
+    if(bl.tempAngle == 0)
+      bl.prevAngle = 0;
+    if(!bl.falling)
+      bl.prevBase = glm::vec3(bl.memoryMat[3][0], bl.memoryMat[3][1], bl.memoryMat[3][2]);
+}
+
+// Segments 0-6 as the score lays them out, see ssx/ssy/ssa below
+static const unsigned char segmentsOf[10] = {
+    0x7B, 0x03, 0x3E, 0x7C, 0x65, 0x5D, 0x5F, 0x70, 0x7F, 0x7D
+};
+
+int digitSegments (int digit)
+{
+    if((unsigned)digit > 9)
+      return 0x7F;
+    return segmentsOf[digit];
+}
+
+// Where each segment sits and how it is turned, for the digit at dx = 0
+static const float ssx[7] = {3.5,3.5,3.5,3.5,3.5,3.7,3.7};
+static const float ssy[7] = {3.5,3.2,3.45,3.15,3.75,3.5,3.2};
+static const float ssa[7] = {0,0,-90,-90,-90,0,0};
+
+// Shapes the unit cube into one thin segment, spanning (-0.02,-0.02) to (0.02,0.2) around its pivot
+static const glm::mat4 segmentShape = glm::translate(glm::vec3(0, 0.09, 0)) * glm::scale(glm::vec3(0.04, 0.22, 0.01));
+
+glm::mat4 segmentModel (int i, float dx)
+{
+    glm::mat4 translateRectangle = glm::translate (glm::vec3(ssx[i] + dx, ssy[i], 0));        // glTranslatef
+    glm::mat4 rotateRectangle = glm::rotate((float)(ssa[i]*M_PI/180.0f), glm::vec3(0,0,1));
+    return translateRectangle * rotateRectangle * segmentShape;
+}
+
+void listTileInstances (const unsigned char* grid, int width, int height, glm::vec3 origin,
+                        std::vector<glm::vec4>& instances, std::vector<int>& slot)
+{
+    instances.clear();
+    slot.assign(width*height, -1);
+    for(int y = 0; y < height; y++)
+      for(int x = 0; x < width; x++)
+      {
+        int type = grid[y*width + x];
+        if(type != TILE_EMPTY)
+        {
+          slot[y*width + x] = instances.size();
+          instances.push_back(glm::vec4(origin + glm::vec3(x, 0, -y), (float)type));
+        }
+      }
+}
+
+void appendTileInstances (const unsigned char* grid, int width, const int* cells, int count, glm::vec3 origin,
+                          std::vector<glm::vec4>& instances)
+{
+    for(int k = 0; k < count; k++)
+    {
+      int c = cells[k];
+      instances.push_back(glm::vec4(origin + glm::vec3(c % width, 0, -(c / width)), (float)grid[c]));
+    }
+}
+
+int patchTileInstance (const unsigned char* grid, int width, int c, glm::vec3 origin,
+                       std::vector<int>& slot, int& count, int capacity, glm::vec4& instance)
+{
+    int type = grid[c];
+    if(slot[c] < 0)
+    {
+      if(type == TILE_EMPTY)
+        return -1;
+      if(count == capacity)
+        return -2;
+      slot[c] = count++;
+    }
+    instance = glm::vec4(origin + glm::vec3(c % width, 0, -(c / width)), (float)type);
+    return slot[c];
+}
@@ -0,0 +1,75 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Game.h"
+
+/* The CPU half of a frame - the block's animation, the score digits and the tile instances.
+   Only glm in here, no GL calls, so bench/microbench.cpp can time it without a window. */
+
+/* The block as drawn. The GameState says where it rests, this animates it getting there:
+   the vertex shader (drawMode 2) rolls it by tempAngle about the pivot edge (tx,ty,tz). */
+struct Block
+{
+    int state,move,angle,tempAngle;
+    int speed;//Animation speed
+    int x,y,z;//Which axis to rotate around
+    glm::mat4 memoryMat;//Stores all prev transformations of block
+    glm::vec3 prevBase;//Resting position at the previous simulation step
+    int prevAngle;//Roll angle at the previous simulation step
+    float cx,cy,cz;//Current center of block
+    float tx,ty,tz;//Which edge of the block to rotate around
+    int sx,sy,sz;//Scale factor
+    int events;//StepEvent flags of the move being animated, applied when the roll ends
+    bool falling;
+};
+
+Block initBlock (float cx, float cy, float cz, int sx, int sy, int sz);
+
+// Put the block where the game says it rests, on a floor whose tile (0,0) is centred at origin
+void poseBlock (const GameState& game, Block& bl, glm::vec3 origin);
+
+// Start animating move m from the current pose, events being what step() reported for it
+void beginRoll (Block& bl, Move m, int events);
+
+enum BlockTick {
+    BLOCK_MOVING,     // nothing for the caller to do
+    BLOCK_ROLLED,     // the roll has been shown, call endRoll()
+    BLOCK_LANDED      // the fall has been shown, respawn
+};
+
+// One fixed simulation step of the animation
+int animateBlock (Block& bl);
+
+// Clear a finished roll and pose the block where game says, falling if the move made it fall.
+// Returns the roll's StepEvent flags.
+int endRoll (const GameState& game, Block& bl, glm::vec3 origin);
+
+// Last call of a simulation step: only falls interpolate between steps, anything else snaps
+void snapBlock (Block& bl);
+
+// Seven-segment mask of a digit, bit i lit = segment i of the score layout. Anything but 0-9 lights all seven.
+int digitSegments (int digit);
+
+// Model matrix of segment i of the score digit dx along the score line, a stretched unit cube
+glm::mat4 segmentModel (int i, float dx);
+
+// One instance per non-empty cell of a width*height grid, row-major: xyz the tile centre,
+// origin + (x, 0, -y), and w the tile type. slot gets cell -> instance index, -1 if empty.
+void listTileInstances (const unsigned char* grid, int width, int height, glm::vec3 origin,
+                        std::vector<glm::vec4>& instances, std::vector<int>& slot);
+
+// Append the instances of count cells listed by index (y*width + x), as listTileInstances() lays them out
+void appendTileInstances (const unsigned char* grid, int width, const int* cells, int count, glm::vec3 origin,
+                          std::vector<glm::vec4>& instances);
+
+/* Where cell c's instance goes now that its type changed to grid[c] - its old slot, or the next
+   one (count, which is bumped) if it had none - with the instance in instance. -1 if it had
+   none and is empty, so nothing is to be drawn; -2 if it needs a slot and count is capacity. */
+int patchTileInstance (const unsigned char* grid, int width, int c, glm::vec3 origin,
+                       std::vector<int>& slot, int& count, int capacity, glm::vec4& instance);
+
+#endif
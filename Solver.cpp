@@ -0,0 +1,259 @@
+#include <algorithm>
+#include <stdint.h>
+#include <unordered_set>
+
+#include "Solver.h"
+
+using namespace std;
+
+static const char moveName[NUM_MOVES] = {'L', 'R', 'U', 'D'};
+
+// Switch groups and fragile tiles share the dyn bits. Every switch group is tracked, fragile
+// tiles only in the bits left over - breaking one drops the block anyway.
+#define MAX_TRACKED_DYN 64
+
+struct SearchNode {
+    int cell;           // (minY+1)*cols + minX+1 - the block's lower cell, padded so a half hanging off the edge still fits
+    int orientation;
+    uint64_t dyn;       // bit j switch group j pressed an odd number of times since start, then one bit per tracked fragile tile broken
+    int parent;
+    char move;
+};
+
+struct PairHash {
+    size_t operator() (const pair<uint64_t,int>& k) const
+    {
+      return (size_t)((k.first * 0x9E3779B97F4A7C15ull) ^ (uint64_t)k.second);
+    }
+};
+
+struct Search {
+    const GameState* start;
+    GameState scratch;              // start's tiles, with one node's dynamic tiles applied at a time
+    const vector<SwitchGroup>* switches;
+    int numSwitches;                // all of the level's groups, at most SOLVER_MAX_SWITCHES
+    vector<int> fragX, fragY;       // fragile tiles still intact in start
+    int cols, rows;
+
+    // Visited set - a flat bitmap when the key space is small, which it is for real levels,
+    // else hashed on the dyn bits and the block's position separately so no bit is lost
+    vector<char> flat;
+    unordered_set<pair<uint64_t,int>, PairHash> sparse;
+};
+
+// Block position of a node, orientation and cell
+static int nodePos (const Search& s, const SearchNode& n)
+{
+    return (n.orientation - 1) * (s.cols * s.rows) + n.cell;
+}
+
+// Mark the node seen, false if it already was
+static bool visit (Search& s, const SearchNode& n)
+{
+    if(!s.flat.empty())
+    {
+      char &seen = s.flat[n.dyn * 3 * (s.cols * s.rows) + nodePos(s, n)];
+      if(seen)
+        return false;
+      seen = 1;
+      return true;
+    }
+    return s.sparse.insert(make_pair(n.dyn, nodePos(s, n))).second;
+}
+
+// Put the bridge and fragile cells back the way start has them
+static void resetTiles (Search& s)
+{
+    int w = s.scratch.width;
+    for(int j = 0; j < (int)s.switches->size(); j++)
+    {
+      const SwitchGroup& sw = (*s.switches)[j];
+      for(int k = 0; k < (int)sw.bridgeX.size(); k++)
+      {
+        int c = sw.bridgeY[k] * w + sw.bridgeX[k];
+        s.scratch.tiles[c] = s.start->tiles[c];
+      }
+    }
+    for(int j = 0; j < (int)s.fragX.size(); j++)
+    {
+      int c = s.fragY[j] * w + s.fragX[j];
+      s.scratch.tiles[c] = s.start->tiles[c];
+    }
+    s.scratch.toggled = s.start->toggled;
+}
+
+// Load node n into the scratch game, which must have clean tiles
+static void loadNode (Search& s, const SearchNode& n)
+{
+    GameState& g = s.scratch;
+    int mx = n.cell % s.cols - 1, my = n.cell / s.cols - 1;
+    g.orientation = n.orientation;
+    g.x1 = g.x2 = mx;
+    g.y1 = g.y2 = my;
+    if(n.orientation == LYING_X)
+      g.x1 = mx + 1;
+    else if(n.orientation == LYING_Y)
+      g.y2 = my + 1;
+    g.status = PLAYING;
+    g.teleported = false;
+
+    int numSwitches = s.numSwitches;
+    for(int j = 0; j < numSwitches; j++)
+      if(n.dyn & ((uint64_t)1 << j))
+        toggleBridges(g, *s.switches, j);
+    for(int j = 0; j < (int)s.fragX.size(); j++)
+      if(n.dyn & ((uint64_t)1 << (numSwitches + j)))
+        g.tiles[s.fragY[j] * g.width + s.fragX[j]] = TILE_EMPTY;
+}
+
+// Read the scratch game back into a node
+static SearchNode storeNode (const Search& s)
+{
+    const GameState& g = s.scratch;
+    SearchNode n;
+    n.cell = (min(g.y1, g.y2) + 1) * s.cols + min(g.x1, g.x2) + 1;
+    n.orientation = g.orientation;
+    n.dyn = 0;
+    int numSwitches = s.numSwitches;
+    for(int j = 0; j < numSwitches; j++)
+      if((g.toggled ^ s.start->toggled) & ((uint64_t)1 << j))
+        n.dyn |= (uint64_t)1 << j;
+    for(int j = 0; j < (int)s.fragX.size(); j++)
+      if(tileAt(g, s.fragX[j], s.fragY[j]) == TILE_EMPTY)
+        n.dyn |= (uint64_t)1 << (numSwitches + j);
+    n.parent = -1;
+    n.move = 0;
+    return n;
+}
+
+static string pathTo (const vector<SearchNode>& nodes, int i)
+{
+    string path;
+    for(; i >= 0 && nodes[i].move; i = nodes[i].parent)
+      path += nodes[i].move;
+    reverse(path.begin(), path.end());
+    return path;
+}
+
+// Search the level's compiled graph - each move is one load from the edge array
+static Solution solveGraph (const LevelGraph& g, int start)
+{
+    Solution sol;
+    sol.solved = false;
+    sol.supported = true;
+    sol.expanded = 0;
+
+    int numNodes = g.keyOf.size();
+    vector<int> parent(numNodes, -2);     // -2 not reached yet, -1 the start
+    vector<char> moveTo(numNodes, 0);
+    vector<int> queue;
+    queue.reserve(numNodes);
+    queue.push_back(start);
+    parent[start] = -1;
+
+    for(int head = 0; head < (int)queue.size(); head++)
+    {
+      int n = queue[head];
+      sol.expanded++;
+      for(int m = 0; m < NUM_MOVES; m++)
+      {
+        uint32_t edge = g.edges[n * NUM_MOVES + m];
+        int events = edge >> GRAPH_EVENT_SHIFT;
+        if(events & (EV_LEVEL | EV_WON))
+        {
+          sol.solved = true;
+          sol.moves = moveName[m];
+          for(int i = n; parent[i] >= 0; i = parent[i])
+            sol.moves += moveTo[i];
+          reverse(sol.moves.begin(), sol.moves.end());
+          return sol;
+        }
+        int t = edge & GRAPH_NODE_MASK;
+        if(!(events & EV_FELL) && parent[t] == -2)
+        {
+          parent[t] = n;
+          moveTo[t] = moveName[m];
+          queue.push_back(t);
+        }
+      }
+    }
+    return sol;
+}
+
+Solution solve (const GameState& state)
+{
+    Solution sol;
+    sol.solved = false;
+    sol.supported = true;
+    sol.expanded = 0;
+    if(state.status != PLAYING)
+      return sol;
+
+    const Level& lvl = (*state.levels)[state.level];
+    if(state.node >= 0)
+      return solveGraph(lvl.graph, state.node);
+    if(lvl.switches.size() > SOLVER_MAX_SWITCHES)
+    {
+      sol.supported = false;
+      return sol;
+    }
+
+    Search s;
+    s.start = &state;
+    s.scratch = state;
+    s.switches = &lvl.switches;
+    s.numSwitches = lvl.switches.size();
+    for(int j = 0; j < (int)lvl.fragX.size() && s.numSwitches + (int)s.fragX.size() < MAX_TRACKED_DYN; j++)
+      if(tileAt(state, lvl.fragX[j], lvl.fragY[j]) != TILE_EMPTY)
+      {
+        s.fragX.push_back(lvl.fragX[j]);
+        s.fragY.push_back(lvl.fragY[j]);
+      }
+    s.cols = lvl.width + 2;
+    s.rows = lvl.height + 2;
+    int dynBits = s.numSwitches + s.fragX.size();
+    uint64_t keys = dynBits < 22 ? ((uint64_t)3 * s.cols * s.rows) << dynBits : UINT64_MAX;
+    if(keys <= (1u << 22))
+      s.flat.assign(keys, 0);
+
+    // The queue is the node list itself, parents are indices into it
+    vector<SearchNode> nodes;
+    nodes.reserve(1024);
+    nodes.push_back(storeNode(s));
+    visit(s, nodes[0]);
+
+    for(int head = 0; head < (int)nodes.size(); head++)
+    {
+      sol.expanded++;
+      for(int m = 0; m < NUM_MOVES; m++)
+      {
+        loadNode(s, nodes[head]);
+        int events = step(s.scratch, (Move)m);
+        if(events & (EV_LEVEL | EV_WON))
+        {
+          sol.solved = true;
+          sol.moves = pathTo(nodes, head) + moveName[m];
+          return sol;
+        }
+        if(!(events & EV_FELL))
+        {
+          SearchNode next = storeNode(s);
+          if(visit(s, next))
+          {
+            next.parent = head;
+            next.move = moveName[m];
+            nodes.push_back(next);
+          }
+        }
+        resetTiles(s);
+      }
+    }
+    return sol;
+}
+
+Solution solveLevel (const vector<Level>& levels, int level)
+{
+    GameState state = newGame(levels);
+    loadLevel(state, level);
+    return solve(state);
+}
@@ -0,0 +1,32 @@
+#ifndef SOLVER_H
+#define SOLVER_H
+
+#include <string>
+#include <vector>
+
+#include "Game.h"
+
+/* Breadth-first search for the shortest way through a level. On a compiled level it walks
+   the LevelGraph, one load per move. Otherwise a search state is the block's resting cells
+   and orientation plus the dynamic tiles - which switch groups are toggled and which fragile
+   tiles are broken - and moves are applied with step(), so either way the solver plays by
+   exactly the rules the game does. */
+
+// Switch groups a search tracks, one toggled bit each as in GameState::toggled. Levels with
+// more are refused rather than searched with some groups' bridges ignored.
+#define SOLVER_MAX_SWITCHES 64
+
+struct Solution {
+    bool solved;
+    bool supported;         // false if the level has more than SOLVER_MAX_SWITCHES switch groups - nothing was searched
+    std::string moves;      // one letter per move - L, R, U, D as in Move
+    int expanded;           // states taken off the queue
+};
+
+// Shortest move sequence from state to the goal of its current level
+Solution solve (const GameState& state);
+
+// Shortest move sequence for level index, from its start tile
+Solution solveLevel (const std::vector<Level>& levels, int level);
+
+#endif
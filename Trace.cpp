@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#include "Trace.h"
+
+using namespace std;
+
+atomic<bool> traceOn(false);
+
+struct TraceEvent {
+    const char* name;
+    int64_t start, end;     // ns since traceStart()
+};
+
+// One per thread that has recorded, kept until traceStop() writes it
+struct TraceBuffer {
+    int tid;
+    const char* threadName;
+    vector<TraceEvent> events;
+};
+
+static mutex buffersLock;                   // guards buffers, taken once per thread
+static vector<TraceBuffer*> buffers;
+static thread_local TraceBuffer* own = NULL;
+static FILE* traceFile = NULL;
+static chrono::steady_clock::time_point origin;
+
+static TraceBuffer& ownBuffer ()
+{
+    if(own == NULL)
+    {
+      own = new TraceBuffer;
+      own->threadName = NULL;
+      own->events.reserve(4096);
+      lock_guard<mutex> guard(buffersLock);
+      own->tid = buffers.size() + 1;
+      buffers.push_back(own);
+    }
+    return *own;
+}
+
+int64_t traceNow ()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - origin).count();
+}
+
+void traceRecord (const char* name, int64_t start, int64_t end)
+{
+    TraceEvent e = {name, start, end};
+    ownBuffer().events.push_back(e);
+}
+
+void traceThreadName (const char* name)
+{
+    if(traceOn.load(memory_order_relaxed))
+      ownBuffer().threadName = name;
+}
+
+bool traceStart (const char* path)
+{
+    traceFile = fopen(path, "w");
+    if(traceFile == NULL)
+    {
+      fprintf(stderr, "Trace: cannot write %s\n", path);
+      return false;
+    }
+    origin = chrono::steady_clock::now();
+    traceOn = true;
+    // Registered before the audio and streaming threads' atexit handlers, so it runs after they are joined
+    static bool registered = false;
+    if(!registered)
+    {
+      atexit(traceStop);
+      registered = true;
+    }
+    return true;
+}
+
+void traceStop ()
+{
+    if(traceFile == NULL)
+      return;
+    traceOn = false;
+    // Times in microseconds, the unit the format expects
+    fprintf(traceFile, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    const char* sep = "";
+    for(int b = 0; b < (int)buffers.size(); b++)
+    {
+      TraceBuffer* buf = buffers[b];
+      if(buf->threadName)
+      {
+        fprintf(traceFile, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                sep, buf->tid, buf->threadName);
+        sep = ",\n";
+      }
+      for(int k = 0; k < (int)buf->events.size(); k++)
+      {
+        const TraceEvent& e = buf->events[k];
+        fprintf(traceFile, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                sep, e.name, buf->tid, e.start / 1000.0, (e.end - e.start) / 1000.0);
+        sep = ",\n";
+      }
+      buf->events.clear();
+    }
+    fprintf(traceFile, "\n]}\n");
+    fclose(traceFile);
+    traceFile = NULL;
+}
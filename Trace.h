@@ -0,0 +1,52 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+/* Scoped timing markers written out as Chrome Trace Event JSON - open the file in
+   chrome://tracing or ui.perfetto.dev to see where a frame's time goes, thread by thread.
+
+     TRACE_SCOPE("drawBlock");   // times from here to the end of the enclosing block
+
+   While tracing is off a marker is one relaxed load and a branch. While it is on, each thread
+   appends to its own buffer, so markers never take a lock after a thread's first one. */
+
+extern std::atomic<bool> traceOn;
+
+// Record from now on, to be written to path by traceStop(). False if path cannot be written.
+bool traceStart (const char* path);
+
+// Write everything recorded and stop. Every other thread that recorded must have been joined.
+void traceStop ();
+
+// Label the calling thread in the trace
+void traceThreadName (const char* name);
+
+int64_t traceNow ();
+void traceRecord (const char* name, int64_t start, int64_t end);
+
+struct TraceScope {
+    const char* name;       // a string literal, NULL when tracing was off at the start
+    int64_t start;
+    TraceScope (const char* n) : name(NULL)
+    {
+      if(traceOn.load(std::memory_order_relaxed))
+      {
+        name = n;
+        start = traceNow();
+      }
+    }
+    ~TraceScope ()
+    {
+      if(name)
+        traceRecord(name, start, traceNow());
+    }
+};
+
+#define TRACE_JOIN2(a, b) a##b
+#define TRACE_JOIN(a, b) TRACE_JOIN2(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_JOIN(traceScope, __LINE__)(name)
+
+#endif
@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "../Game.h"
+#include "../LevelFile.h"
+#include "../Scene.h"
+#include "../Solver.h"
+
+using namespace std;
+
+/* microbench [levels.blxp] - ns per call of the CPU work behind a frame, the same functions
+   the game calls: a simulation step of the block's animation with the moves it starts,
+   step() on the rules and on a compiled graph, the score digits' model matrices, patching a
+   changed tile's instance and the tile grid walk that builds a level's instances.
+
+   Each case is first run with a doubling call count until one batch takes BATCH_MS, then
+   timed for SAMPLES batches of that count. The median batch is reported with the fastest
+   and slowest, so a noisy run shows up as a wide spread instead of a wrong number. Every
+   result is folded into sink, which is printed, so nothing can be optimised away. */
+
+#define BATCH_MS 20
+#define SAMPLES 15
+
+typedef chrono::steady_clock Clock;
+
+unsigned sink;
+
+void fold (const glm::mat4 &m)
+{
+    sink += (unsigned)(m[3][0] * 1000) ^ (unsigned)(m[1][1] * 1000);
+}
+
+Move moveOf (char c)
+{
+    return c == 'L' ? MOVE_LEFT : c == 'R' ? MOVE_RIGHT : c == 'U' ? MOVE_UP : MOVE_DOWN;
+}
+
+// One case: run(n) makes n calls of perCall operations each
+template <class Run>
+void measure (const char *name, long perCall, Run run)
+{
+    long n = 1;
+    for(;;)
+    {
+      Clock::time_point t0 = Clock::now();
+      run(n);
+      double ms = chrono::duration<double, milli>(Clock::now() - t0).count();
+      if(ms >= BATCH_MS || n >= (1L << 40))
+        break;
+      n *= ms < BATCH_MS/16.0 ? 8 : 2;
+    }
+    vector<double> ns(SAMPLES);
+    for(int k = 0; k < SAMPLES; k++)
+    {
+      Clock::time_point t0 = Clock::now();
+      run(n);
+      ns[k] = chrono::duration<double, nano>(Clock::now() - t0).count() / (n*perCall);
+    }
+    sort(ns.begin(), ns.end());
+    printf("%-38s %12.2f %12.2f %12.2f %12ld\n", name, ns[SAMPLES/2], ns[0], ns[SAMPLES-1], n*perCall);
+}
+
+// Replay every level's solution back to back, from level one again after the last
+struct Replay {
+    GameState game;
+    string moves;
+    size_t next;
+};
+
+Replay startReplay (const vector<Level> &levels)
+{
+    Replay r;
+    for(int l = 0; l < (int)levels.size(); l++)
+      r.moves += solveLevel(levels, l).moves;
+    r.game = newGame(levels, 1 << 30);
+    r.next = 0;
+    return r;
+}
+
+void replay (Replay &r, long n)
+{
+    for(long k = 0; k < n; k++)
+    {
+      sink += step(r.game, moveOf(r.moves[r.next]));
+      if(++r.next == r.moves.size() || r.game.status != PLAYING)
+      {
+        loadLevel(r.game, 0);
+        r.next = 0;
+      }
+    }
+}
+
+/* What simulate() does for a session, without its GL uploads and sound: start the next
+   scripted move whenever the block is free (startRoll), then one animation step
+   (updateBlock), respawning after falls and going back to level one after the last */
+struct Bot {
+    Replay replay;
+    Block block;
+};
+
+void simulateBot (Bot &b, long n)
+{
+    glm::vec3 origin(-7, -4, 0);
+    Replay &r = b.replay;
+    Block &bl = b.block;
+    for(long k = 0; k < n; k++)
+    {
+      if(bl.move == 0 && !bl.falling && r.game.status == PLAYING)
+      {
+        Move m = moveOf(r.moves[r.next]);
+        if(++r.next == r.moves.size())
+          r.next = 0;
+        beginRoll(bl, m, step(r.game, m));
+      }
+      int tick = animateBlock(bl);
+      if(tick == BLOCK_LANDED)
+      {
+        bl.falling = false;
+        respawn(r.game);
+        poseBlock(r.game, bl, origin);
+      }
+      else if(tick == BLOCK_ROLLED && (endRoll(r.game, bl, origin) & EV_WON))
+      {
+        loadLevel(r.game, 0);
+        r.next = 0;
+        poseBlock(r.game, bl, origin);
+      }
+      snapBlock(bl);
+      sink += bl.tempAngle;
+    }
+}
+
+int main (int argc, char** argv)
+{
+    const char *path = argc > 1 ? argv[1] : "levels.blxp";
+    vector<Level> levels;
+    LevelPack pack;
+    if(!loadLevels(path, levels, pack) || levels.empty())
+    {
+      fprintf(stderr, "microbench: no levels in %s\n", path);
+      return 1;
+    }
+    for(int l = 0; l < (int)levels.size(); l++)
+      if(!checkLevelTiles(levels[l]))
+        return 1;
+    vector<Level> compiled = levels;
+    for(int l = 0; l < (int)compiled.size(); l++)
+      compileLevel(compiled, l);
+
+    printf("%-38s %12s %12s %12s %12s\n", "case", "ns/op", "min", "max", "ops/batch");
+
+    Replay rules = startReplay(levels);
+    measure("step, rules", 1, [&](long n) { replay(rules, n); });
+    Replay graph = startReplay(compiled);
+    measure("step, compiled graph", 1, [&](long n) { replay(graph, n); });
+
+    Bot bot;
+    bot.replay = startReplay(compiled);
+    bot.block = initBlock(0,-2.8,-3,1,2,1);
+    poseBlock(bot.replay.game, bot.block, glm::vec3(-7, -4, 0));
+    measure("simulate, one step of a replaying block", 1, [&](long n) { simulateBot(bot, n); });
+
+    // drawDigit's matrices for the three digits of drawPrintScore, per segment drawn
+    glm::mat4 VP = glm::perspective(1.0f, 16/9.0f, 0.1f, 100.0f) * glm::lookAt(glm::vec3(0, 5, 5), glm::vec3(0), glm::vec3(0, 1, 0));
+    measure("score digits, segment MVP", 1, [&](long n) {
+      for(long k = 0; k < n; )
+      {
+        int moves = k % 1000, lives = k & 7;
+        int sec = (moves/10) % 100;
+        int digits[3] = {digitSegments(lives % 10), digitSegments(moves % 10), sec == 0 ? 0 : digitSegments(sec)};
+        float dx[3] = {-7, 0, -0.5};
+        for(int d = 0; d < 3; d++)
+          for(int i = 0; i < 7; i++)
+            if(digits[d] & (1 << i))
+            {
+              fold(VP * segmentModel(i, dx[d]));
+              k++;
+            }
+      }
+    });
+
+    // The grid walk, per level baked and per tile
+    vector<glm::vec4> instances;
+    vector<int> slot;
+    const Level &last = levels.back();
+    char name[64];
+    snprintf(name, sizeof name, "listTileInstances, %dx%d level", last.width, last.height);
+    measure(name, 1, [&](long n) {
+      for(long k = 0; k < n; k++)
+      {
+        listTileInstances(levelCells(last), last.width, last.height, glm::vec3(-7, -4, 0), instances, slot);
+        sink += instances.size();
+      }
+    });
+    // A switch or a broken tile re-uploads one instance per changed cell
+    const unsigned char *lastCells = levelCells(last);
+    vector<unsigned char> live(lastCells, lastCells + last.width*last.height);
+    listTileInstances(live.data(), last.width, last.height, glm::vec3(-7, -4, 0), instances, slot);
+    int count = instances.size();
+    measure("patchTileInstance, changed cell", 1, [&](long n) {
+      glm::vec4 instance;
+      for(long k = 0; k < n; k++)
+      {
+        int c = k % live.size();
+        live[c] = live[c] == TILE_EMPTY ? TILE_BRIDGE : TILE_EMPTY;
+        int at = patchTileInstance(live.data(), last.width, c, glm::vec3(-7, -4, 0), slot, count, (int)live.size(), instance);
+        sink += at + (unsigned)instance.w;
+      }
+    });
+
+    for(int size = 64; size <= 1024; size *= 4)
+    {
+      Level grid = generateLevel(size, size, 12345);
+      snprintf(name, sizeof name, "listTileInstances, %dx%d per tile", size, size);
+      measure(name, size*size, [&](long n) {
+        for(long k = 0; k < n; k++)
+        {
+          listTileInstances(levelCells(grid), size, size, glm::vec3(-7, -4, 0), instances, slot);
+          sink += instances.size();
+        }
+      });
+    }
+
+    printf("sink %u\n", sink);
+    closeLevelPack(pack);
+    return 0;
+}
@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../Game.h"
+#include "../LevelFile.h"
+#include "../Solver.h"
+
+using namespace std;
+
+/* simbench [levels.blxp] [--seconds S] [--threads N] - moves per second through step() with
+   no window, the capacity of bots playtesting the levels. Each case plays its levels for S
+   seconds (default 2) on one thread, then on N threads (default every core), every thread
+   its own game on the same read-only levels:
+     scripted   every level's solution back to back, from level one again after the last
+     random     moves from a fixed-seed generator, respawning after falls
+   on the packed levels and a generated 256x256 one, with and without their compiled graphs,
+   and on a generated 2048x2048 level, which is past GRAPH_MAX_NODES and only has the rules.
+   The per-thread figure shows how far the threads scale. */
+
+typedef chrono::steady_clock Clock;
+
+#define CHUNK 4096      // moves between looks at the clock
+
+volatile unsigned sink;   // the events of every step summed, so none can be optimised away
+
+struct Case {
+    string name;
+    const vector<Level>* levels;
+    string script;      // empty for random moves
+};
+
+// Own cache lines, so threads writing their counters do not slow each other down
+struct alignas(64) Player {
+    GameState game;
+    size_t next;
+    unsigned seed;
+    long moves;
+    unsigned sink;
+};
+
+static Move nextMove (const Case& c, Player& p)
+{
+    if(c.script.empty())
+    {
+      p.seed = p.seed * 1103515245 + 12345;
+      return (Move)((p.seed >> 16) % NUM_MOVES);
+    }
+    char m = c.script[p.next];
+    if(++p.next == c.script.size())
+      p.next = 0;
+    return m == 'L' ? MOVE_LEFT : m == 'R' ? MOVE_RIGHT : m == 'U' ? MOVE_UP : MOVE_DOWN;
+}
+
+static void play (const Case& c, Player& p, const atomic<bool>& stop)
+{
+    while(!stop.load(memory_order_relaxed))
+    {
+      for(int k = 0; k < CHUNK; k++)
+      {
+        p.sink += step(p.game, nextMove(c, p));
+        if(p.game.status == FALLING)
+          respawn(p.game);
+        else if(p.game.status == WON)
+        {
+          loadLevel(p.game, 0);
+          p.next = 0;
+        }
+      }
+      p.moves += CHUNK;
+    }
+}
+
+// Moves per second over all threads
+static double run (const Case& c, int threads, double seconds)
+{
+    vector<Player> players(threads);
+    for(int t = 0; t < threads; t++)
+    {
+      players[t].game = newGame(*c.levels, 1 << 30);
+      players[t].next = 0;
+      players[t].seed = 1 + t;
+      players[t].moves = 0;
+      players[t].sink = 0;
+    }
+    atomic<bool> stop(false);
+    vector<thread> workers;
+    Clock::time_point t0 = Clock::now();
+    for(int t = 0; t < threads; t++)
+      workers.push_back(thread(play, cref(c), ref(players[t]), cref(stop)));
+    this_thread::sleep_for(chrono::duration<double>(seconds));
+    stop = true;
+    for(int t = 0; t < threads; t++)
+      workers[t].join();
+    double elapsed = chrono::duration<double>(Clock::now() - t0).count();
+
+    long moves = 0;
+    for(int t = 0; t < threads; t++)
+    {
+      moves += players[t].moves;
+      sink += players[t].sink;
+    }
+    return moves / elapsed;
+}
+
+int main (int argc, char** argv)
+{
+    const char* path = "levels.blxp";
+    double seconds = 2;
+    int cores = thread::hardware_concurrency();
+    if(cores < 1)
+      cores = 1;
+    for(int a = 1; a < argc; a++)
+      if(strcmp(argv[a], "--seconds") == 0 && a + 1 < argc)
+        seconds = atof(argv[++a]);
+      else if(strcmp(argv[a], "--threads") == 0 && a + 1 < argc)
+        cores = max(1, atoi(argv[++a]));
+      else
+        path = argv[a];
+
+    vector<Level> levels;
+    LevelPack pack;
+    if(!loadLevels(path, levels, pack) || levels.empty())
+    {
+      fprintf(stderr, "simbench: no levels in %s\n", path);
+      return 1;
+    }
+    for(int l = 0; l < (int)levels.size(); l++)
+      if(!checkLevelTiles(levels[l]))
+        return 1;
+    vector<Level> compiled = levels;
+    for(int l = 0; l < (int)compiled.size(); l++)
+      compileLevel(compiled, l);
+    string script;
+    for(int l = 0; l < (int)levels.size(); l++)
+      script += solveLevel(levels, l).moves;
+    vector<Level> medium(1, generateLevel(256, 256, 12345));
+    vector<Level> mediumCompiled = medium;
+    compileLevel(mediumCompiled, 0);
+    vector<Level> large(1, generateLevel(2048, 2048, 12345));
+
+    vector<Case> cases;
+    Case c;
+    char name[64];
+    snprintf(name, sizeof name, "%d levels, scripted, rules", (int)levels.size());
+    c.name = name; c.levels = &levels; c.script = script; cases.push_back(c);
+    snprintf(name, sizeof name, "%d levels, scripted, graph", (int)levels.size());
+    c.name = name; c.levels = &compiled; cases.push_back(c);
+    snprintf(name, sizeof name, "%d levels, random, rules", (int)levels.size());
+    c.name = name; c.levels = &levels; c.script = ""; cases.push_back(c);
+    snprintf(name, sizeof name, "%d levels, random, graph", (int)levels.size());
+    c.name = name; c.levels = &compiled; cases.push_back(c);
+    c.name = "256x256 generated, random, rules"; c.levels = &medium; cases.push_back(c);
+    c.name = "256x256 generated, random, graph"; c.levels = &mediumCompiled; cases.push_back(c);
+    c.name = "2048x2048 generated, random, rules"; c.levels = &large; cases.push_back(c);
+
+    printf("%d threads, %.1f s per run\n", cores, seconds);
+    printf("%-36s %14s %14s %14s %8s\n", "case", "1 thread", "all threads", "per thread", "scaling");
+    for(int k = 0; k < (int)cases.size(); k++)
+    {
+      double one = run(cases[k], 1, seconds);
+      double all = run(cases[k], cores, seconds);
+      printf("%-36s %14.0f %14.0f %14.0f %7.2fx\n", cases[k].name.c_str(), one, all, all / cores, all / one);
+    }
+    closeLevelPack(pack);
+    return 0;
+}
@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "../Game.h"
+#include "randomlevel.h"
+
+using namespace std;
+
+/* graphcheck [N] - N random level pairs (default 200), each played MOVES random moves twice
+   in lockstep: once by the tile rules and once along the compiled graphs. Both games must
+   report the same events and end every move in the same state - block, tiles, toggled
+   switch groups, level, lives and status - through falls and respawns, shared bridge cells
+   and the first level's goal taking the game on to the second. Prints the first level that
+   differs and exits 1. */
+
+#define MOVES 400
+
+static bool same (const GameState& a, const GameState& b)
+{
+    return a.level == b.level && a.x1 == b.x1 && a.y1 == b.y1 && a.x2 == b.x2 && a.y2 == b.y2 &&
+           a.orientation == b.orientation && a.status == b.status && a.lives == b.lives &&
+           a.moves == b.moves && a.toggled == b.toggled && a.tiles == b.tiles;
+}
+
+int main (int argc, char** argv)
+{
+    int count = argc > 1 ? atoi(argv[1]) : 200;
+    int compiled = 0;
+    long graphMoves = 0, goals = 0;
+    for(int n = 0; n < count; n++)
+    {
+      vector<Level> rules;
+      rules.push_back(randomLevel());
+      rules.push_back(randomLevel());
+      vector<Level> graphs = rules;
+      for(int l = 0; l < (int)graphs.size(); l++)
+      {
+        compileLevel(graphs, l);
+        compiled += !graphs[l].graph.edges.empty();
+      }
+
+      GameState a = newGame(rules, 1 << 30), b = newGame(graphs, 1 << 30);
+      for(int k = 0; k < MOVES; k++)
+      {
+        Move m = (Move)rnd(NUM_MOVES);
+        graphMoves += b.node >= 0;
+        int ea = step(a, m), eb = step(b, m);
+        goals += (ea & (EV_LEVEL | EV_WON)) != 0;
+        if(a.status == FALLING)
+        {
+          respawn(a);
+          respawn(b);
+        }
+        else if(a.status == WON)
+        {
+          loadLevel(a, 0);
+          loadLevel(b, 0);
+        }
+        if(ea != eb || !same(a, b) || (b.node < 0 && !graphs[b.level].graph.edges.empty()))
+        {
+          fprintf(stderr, "levels %d: move %d (%d) differs - events %d rules, %d graph, on level %d\n",
+                  n, k, m, ea, eb, a.level);
+          printLevel(rules[a.level]);
+          return 1;
+        }
+      }
+    }
+    printf("graphcheck: %d level pairs agree, %d of %d levels compiled, %ld moves on a graph, %ld goals\n",
+           count, compiled, 2 * count, graphMoves, goals);
+    return 0;
+}
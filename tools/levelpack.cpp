@@ -0,0 +1,28 @@
+#include <stdio.h>
+#include <vector>
+
+#include "../LevelFile.h"
+
+using namespace std;
+
+/* levelpack OUT.blxp IN.txt... - check text levels and pack them, in argument order */
+int main (int argc, char** argv)
+{
+    if(argc < 3)
+    {
+      fprintf(stderr, "usage: %s OUT.blxp IN.txt...\n", argv[0]);
+      return 2;
+    }
+    vector<Level> levels;
+    for(int a = 2; a < argc; a++)
+    {
+      Level level;
+      if(!readLevelText(argv[a], level))
+        return 1;
+      levels.push_back(level);
+    }
+    if(!writeLevelPack(argv[1], levels))
+      return 1;
+    printf("%s: %d levels\n", argv[1], (int)levels.size());
+    return 0;
+}
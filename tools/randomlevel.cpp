@@ -0,0 +1,111 @@
+#include <stdio.h>
+
+#include "randomlevel.h"
+
+using namespace std;
+
+static unsigned seed = 1;
+
+int rnd (int n)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) % n;
+}
+
+// A free non-empty cell, marked taken
+static bool pickCell (const Level& level, vector<char>& taken, int& x, int& y)
+{
+    for(int tries = 0; tries < 100; tries++)
+    {
+      x = rnd(level.width);
+      y = rnd(level.height);
+      if(!taken[y * level.width + x])
+      {
+        taken[y * level.width + x] = 1;
+        return true;
+      }
+    }
+    return false;
+}
+
+Level randomLevel (int maxWidth, int maxHeight)
+{
+    Level level;
+    level.name = "random";
+    level.width = 4 + rnd(maxWidth - 3);
+    level.height = 4 + rnd(maxHeight - 3);
+    level.packCells = NULL;
+    int floor = 50 + rnd(45);
+    level.cells.assign(level.width * level.height, TILE_EMPTY);
+    for(int c = 0; c < level.width * level.height; c++)
+      if(rnd(100) < floor)
+        level.cells[c] = rnd(12) == 0 ? TILE_FRAGILE : TILE_FLOOR;
+
+    vector<char> taken(level.width * level.height, 0);
+    pickCell(level, taken, level.startX, level.startY);
+    level.cells[level.startY * level.width + level.startX] = TILE_FLOOR;
+    pickCell(level, taken, level.goalX, level.goalY);
+    level.cells[level.goalY * level.width + level.goalX] = TILE_GOAL;
+    for(int j = rnd(3); j > 0; j--)
+    {
+      Teleporter t;
+      if(!pickCell(level, taken, t.ax, t.ay) || !pickCell(level, taken, t.bx, t.by))
+        break;
+      level.cells[t.ay * level.width + t.ax] = level.cells[t.by * level.width + t.bx] = TILE_TELEPORT;
+      level.teleporters.push_back(t);
+    }
+    for(int j = rnd(3); j > 0; j--)
+    {
+      SwitchGroup sw;
+      if(!pickCell(level, taken, sw.x, sw.y))
+        break;
+      level.cells[sw.y * level.width + sw.x] = rnd(2) ? TILE_SWITCH : TILE_HEAVY_SWITCH;
+      for(int k = 1 + rnd(3); k > 0; k--)
+      {
+        int x, y;
+        // Now and then a bridge cell of an earlier group, which both then toggle
+        if(!level.switches.empty() && rnd(4) == 0)
+        {
+          const SwitchGroup& other = level.switches[rnd(level.switches.size())];
+          int b = rnd(other.bridgeX.size());
+          sw.bridgeX.push_back(other.bridgeX[b]);
+          sw.bridgeY.push_back(other.bridgeY[b]);
+          continue;
+        }
+        if(!pickCell(level, taken, x, y))
+          break;
+        level.cells[y * level.width + x] = rnd(2) ? TILE_BRIDGE : TILE_EMPTY;
+        sw.bridgeX.push_back(x);
+        sw.bridgeY.push_back(y);
+      }
+      level.switches.push_back(sw);
+    }
+    finishLevel(level);
+    return level;
+}
+
+void printLevel (const Level& level)
+{
+    static const char tileChar[NUM_TILE_TYPES + 1] = ".#FSTGHB";
+    fprintf(stderr, "size %d %d\nstart %d %d\n", level.width, level.height, level.startX, level.startY);
+    for(int j = 0; j < (int)level.teleporters.size(); j++)
+    {
+      const Teleporter& t = level.teleporters[j];
+      fprintf(stderr, "teleport %d %d %d %d\n", t.ax, t.ay, t.bx, t.by);
+    }
+    for(int j = 0; j < (int)level.switches.size(); j++)
+    {
+      const SwitchGroup& sw = level.switches[j];
+      fprintf(stderr, "switch %d %d bridge", sw.x, sw.y);
+      for(int k = 0; k < (int)sw.bridgeX.size(); k++)
+        fprintf(stderr, " %d %d", sw.bridgeX[k], sw.bridgeY[k]);
+      fprintf(stderr, "\n");
+    }
+    fprintf(stderr, "grid\n");
+    for(int y = 0; y < level.height; y++)
+    {
+      for(int x = 0; x < level.width; x++)
+        fputc(tileChar[levelTile(level, x, y)], stderr);
+      fputc('\n', stderr);
+    }
+}
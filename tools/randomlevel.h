@@ -0,0 +1,19 @@
+#ifndef RANDOMLEVEL_H
+#define RANDOMLEVEL_H
+
+#include "../Game.h"
+
+/* Random levels for the checks in tools/ - the same sequence on every run */
+
+// 0 to n-1 from the generator the levels are drawn from
+int rnd (int n);
+
+// A level of 4 to maxWidth x 4 to maxHeight cells with holes, fragile tiles, teleporters and
+// switch groups, some of whose bridge cells are shared with another group. Start and goal are
+// on the grid but need not be connected.
+Level randomLevel (int maxWidth = 23, int maxHeight = 15);
+
+// The level in the text format of LevelFile.h, to stderr
+void printLevel (const Level& level);
+
+#endif
@@ -0,0 +1,44 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "../Game.h"
+#include "../Reach.h"
+#include "../Solver.h"
+#include "randomlevel.h"
+
+using namespace std;
+
+/* reachcheck [N] - N random levels (default 2000) with holes, fragile tiles, switch groups and
+   teleporters, every tenth one up to 200 cells wide so it spans several of reachBitboard's
+   64 column strips. On each one reachBitboard() must agree with reachBfs(), and, since both only
+   over-approximate the game, must find the goal whenever the solver does and in no more moves.
+   Prints the first level that fails and exits 1. */
+
+int main (int argc, char** argv)
+{
+    int count = argc > 1 ? atoi(argv[1]) : 2000;
+    int solved = 0;
+    for(int n = 0; n < count; n++)
+    {
+      vector<Level> levels(1, n % 10 == 9 ? randomLevel(200, 40) : randomLevel());
+      Reach bits = reachBitboard(levels[0]), bfs = reachBfs(levels[0]);
+      Solution sol = solveLevel(levels, 0);
+      const char* error = NULL;
+      if(bits.goalMoves != bfs.goalMoves || bits.states != bfs.states)
+        error = "reachBitboard and reachBfs disagree";
+      else if(sol.solved && (bits.goalMoves < 0 || bits.goalMoves > (int)sol.moves.size()))
+        error = "the solver beat reachBitboard";
+      if(error)
+      {
+        fprintf(stderr, "level %d: %s - bitboard %d moves %d states, bfs %d moves %d states, solver %s\n",
+                n, error, bits.goalMoves, bits.states, bfs.goalMoves, bfs.states,
+                sol.solved ? sol.moves.c_str() : "no solution");
+        printLevel(levels[0]);
+        return 1;
+      }
+      solved += sol.solved;
+    }
+    printf("reachcheck: %d levels agree, %d of them solvable\n", count, solved);
+    return 0;
+}